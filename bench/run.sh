@@ -0,0 +1,17 @@
+#!/bin/sh
+# Runs the standard benchmark suite through clox --bench and emits one
+# JSON object per line, suitable for appending to a results log and
+# diffing across commits:
+#
+#   ./bench/run.sh path/to/clox [reps] >> results.jsonl
+set -e
+
+CLOX="${1:?usage: run.sh path/to/clox [reps]}"
+REPS="${2:-10}"
+DIR="$(dirname "$0")"
+
+# Each workload prints its checksum every repetition; keep only the
+# JSON report line.
+for workload in fib binary_trees method_dispatch string_building table_churn gc_stress; do
+    "$CLOX" --bench "$DIR/$workload.lox" "$REPS" | grep '^{'
+done
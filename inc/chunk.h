@@ -3,6 +3,7 @@
 
 #include "common.h"
 #include "value.h"
+#include "table.h"
 
 #define UINT8_COUNT (UINT8_MAX + 1)
 
@@ -10,7 +11,14 @@ typedef enum {
     OP_CALL,
     OP_INVOKE,
     OP_SUPER_INVOKE,
+    // Calls in tail position; the current frame is reused instead of
+    // pushing a new one, so tail recursion runs in constant frame depth.
+    OP_TAIL_CALL,
+    OP_TAIL_INVOKE,
     OP_RETURN,
+    // Suspends the running fiber and hands the popped value to whoever
+    // resumed it; the next resume's argument becomes the yield's value.
+    OP_YIELD,
 
     OP_POP,
     OP_PRINT,
@@ -43,6 +51,11 @@ typedef enum {
     OP_TRUE,
     OP_FALSE,
 
+    OP_BUILD_LIST,
+    OP_INDEX_GET,
+    OP_INDEX_SET,
+    OP_LIST_APPEND,
+
     OP_NOT,
     OP_ADD,
     OP_NEGATE,
@@ -53,14 +66,75 @@ typedef enum {
     OP_EQUAL,
     OP_LESS,
     OP_GREATER,
+
+    // Superinstructions fused by the peephole pass in src/optimizer.c.
+    // The compiler never emits these directly.
+    OP_GET_LOCAL_GET_LOCAL,
+    OP_ADD_CONSTANT,
+    OP_SET_LOCAL_POP,
+    OP_CONSTANT_CALL,
+    // Compare-and-branch: pops both operands and jumps when the comparison
+    // fails, replacing compare + OP_JUMP_IF_FALSE + both pops.
+    OP_LESS_JUMP,
+    OP_GREATER_JUMP,
+    OP_EQUAL_JUMP,
+    // Rewritten from OP_GET_UPVALUE once the compiler proves the captured
+    // variable is never assigned; reads the value stored flat in the
+    // closure, skipping the ObjectUpvalue box.
+    OP_GET_UPVALUE_FLAT,
+
+    // Speculative forms installed by quicken_chunk() once a function runs
+    // hot. Each assumes numeric operands; when the guard fails the site
+    // rewrites itself back to the generic opcode and stays there.
+    OP_ADD_NUMBER,
+    OP_ADD_CONSTANT_NUMBER,
+
+    OP_CODE_COUNT,
 } OPCode;
 
+typedef struct ObjectShape ObjectShape;
+
+// Inline cache for one OP_GET_PROPERTY/OP_SET_PROPERTY site: the shape
+// the last receiver had and the flat slot the name resolved to. A hit
+// is one pointer compare plus an indexed load. For stores that added a
+// new field, next_shape records the transition so repeated
+// initializations skip the shape walk entirely. Shapes stay reachable
+// through the transition tree, so a cached shape can never dangle.
+typedef struct {
+    ObjectShape* shape;
+    ObjectShape* next_shape;
+    int slot;
+} PropertyCache;
+
+#define INVOKE_CACHE_SIZE 2
+
+typedef struct ObjectClass ObjectClass;
+typedef struct ObjectClosure ObjectClosure;
+
+// Polymorphic inline cache for one OP_INVOKE/OP_SUPER_INVOKE site: the
+// last classes dispatched through the site and the closures they
+// resolved to, most recent first. A monomorphic call is one pointer
+// compare; the methods table is only probed on a miss. Cached classes
+// and closures are kept alive through the owning function's GC trace,
+// so a hit can never dangle.
+typedef struct {
+    ObjectClass* klass[INVOKE_CACHE_SIZE];
+    // An ObjectClosure, or a bare ObjectFunction for methods that capture
+    // nothing.
+    Object* method[INVOKE_CACHE_SIZE];
+} InvokeCache;
+
 typedef struct {
     int count;
     int capacity;
     int* lines;
     uint8_t* code;
+    // Code and lines of a cached chunk point into a read-only file
+    // mapping and must not be freed or written.
+    bool mapped;
     ValueArray constants;
+    PropertyCache* caches;
+    InvokeCache* invoke_caches;
 } Chunk;
 
 void init_chunk(Chunk* chunk);
@@ -12,4 +12,40 @@
 #   define DEBUG_TRACE_EXECUTION
 #endif
 
+// Pack Values into a single 64-bit word via NaN boxing so the VM stack,
+// constant pools and table entries move 8 bytes instead of 16. Define
+// VM_NO_NAN_BOXING to fall back to the tagged-union representation.
+#ifndef VM_NO_NAN_BOXING
+#   define NAN_BOXING
+#endif
+
+// Interpreter state (the active VM, allocator pools, scanner and compiler
+// cursors) is thread-local so independent isolates can run on separate OS
+// threads without sharing anything.
+#if defined(_MSC_VER)
+#   define CLOX_THREAD_LOCAL __declspec(thread)
+#else
+#   define CLOX_THREAD_LOCAL _Thread_local
+#endif
+
+// Define VM_PROFILE to count every executed opcode and account invocations
+// and inclusive time per function; profileReport() prints the result. One
+// counter bump per dispatch plus a clock() per call — cheap enough to leave
+// on while reproducing a problem, unlike DEBUG_TRACE_EXECUTION.
+
+// Dispatch instructions in run() with computed gotos where the compiler
+// supports the labels-as-values extension (GCC/Clang). MSVC falls back to
+// the plain switch. Define VM_NO_THREADED_DISPATCH to force the fallback.
+#if (defined(__GNUC__) || defined(__clang__)) && !defined(VM_NO_THREADED_DISPATCH)
+#   define VM_THREADED_DISPATCH
+#endif
+
+// Trace the heap with a small pool of marking threads during major
+// collections on POSIX builds (pthreads plus the GCC/Clang atomic
+// builtins). Windows builds and minor collections stay single-threaded.
+// Define VM_NO_PARALLEL_GC to force the serial collector everywhere.
+#if (defined(__GNUC__) || defined(__clang__)) && !defined(_WIN32) && !defined(VM_NO_PARALLEL_GC)
+#   define VM_PARALLEL_GC
+#endif
+
 #endif
@@ -5,6 +5,7 @@
 #include "vm.h"
 
 ObjectFunction* compile(const char* source);
+ObjectFunction* compile_repl(const char* source);
 void mark_compiler_roots();
 
 #endif
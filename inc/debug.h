@@ -6,4 +6,8 @@
 int disassemble_instruction(Chunk* chunk, int offset);
 void disassemble_chunk(Chunk* chunk, const char* name);
 
+// Prints the VM_PROFILE counters: an opcode histogram followed by per-
+// function call counts and inclusive times.
+void profile_report();
+
 #endif
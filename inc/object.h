@@ -6,6 +6,10 @@
 #include "chunk.h"
 #include "table.h"
 
+#ifdef VM_PROFILE
+#include <time.h>
+#endif
+
 typedef enum {
     OBJECT_CLASS,
     OBJECT_STRING,
@@ -15,33 +19,49 @@ typedef enum {
     OBJECT_CLOSURE,
     OBJECT_UPVALUE,
     OBJECT_BOUND_METHOD,
+    OBJECT_SHAPE,
+    OBJECT_ROPE,
+    OBJECT_LIST,
+    OBJECT_FIBER,
+
+    OBJECT_TYPE_COUNT,
 } ObjectType;
 
 struct Object {
     ObjectType type;
     bool is_marked;
+    bool is_old;
+    bool is_remembered;
     struct Object* next;
 };
 
 typedef Value (*NativeFn)(int arg_count, Value* args);
 
+// Natives declare their signature up front so call_value() verifies the
+// arguments in one place and the C bodies run without defensive checks.
+// 'params' holds one letter per parameter: 'n' number, 's' string-like,
+// 'l' list, 'c' closure or bare function, 'f' fiber, '.' anything.
+// An arity of -1 accepts any argument count and skips the type checks.
 typedef struct {
     Object object;
     NativeFn function;
+    const char* name;   // Static literal; only read for error messages.
+    const char* params;
+    int arity;
 } ObjectNative;
 
 struct ObjectString {
     Object object;
     int length;
-    char* chars;
     uint32_t hash;
+    // Characters live inline with the header; one allocation per string.
+    char chars[];
 };
 
 typedef struct {
     Object object;
     Value* location;
     Value closed;
-    struct ObjectUpvalue* next;
 } ObjectUpvalue;
 
 typedef struct {
@@ -50,42 +70,142 @@ typedef struct {
     int upvalue_count;
     Chunk chunk;
     ObjectString* name;
+    // Invocations plus loop back edges; once it crosses TIER_UP_HEAT the
+    // chunk is run through the optimizer's quickening pass exactly once.
+    uint32_t heat;
+    bool tiered;
+    // Only maintained when compiled with VM_PROFILE; inclusive_time covers
+    // callees as well.
+    uint64_t invocations;
+    double inclusive_time;
 } ObjectFunction;
 
-typedef struct {
+typedef struct ObjectClosure {
     Object object;
     ObjectFunction* function;
+    // Mutable captures are boxed in ObjectUpvalues; captures the compiler
+    // proved immutable are copied into flat and read without indirection.
+    // Each slot uses exactly one of the two arrays.
     ObjectUpvalue** upvalues;
+    Value* flat;
     int upvalue_count;
 } ObjectClosure;
 
-typedef struct {
+typedef struct ObjectClass {
     Object object;
     ObjectString* name;
     Table methods;
 } ObjectClass;
 
+typedef struct {
+    Object object;
+    ValueArray items;
+} ObjectList;
+
+// Lazy concatenation of two string-like values. OP_ADD links a rope in
+// O(1); the characters are only written out when something observes the
+// result, and the flattened (interned) string is memoized so a rope is
+// materialized at most once.
+typedef struct {
+    Object object;
+    int length;
+    Value left;
+    Value right;
+    ObjectString* flat;
+} ObjectRope;
+
+// Hidden class describing one field layout. Shapes form a tree rooted
+// at vm.root_shape: each shape appends one field to its parent's layout
+// and remembers outgoing transitions, so instances initialized the same
+// way end up sharing one shape and field names map to flat slots.
+typedef struct ObjectShape {
+    Object object;
+    struct ObjectShape* parent;
+    ObjectString* name;
+    int slot;
+    int field_count;
+    Table transitions;
+} ObjectShape;
+
 typedef struct {
     Object object;
     ObjectClass* klass;
-    Table fields;
+    ObjectShape* shape;
+    int field_capacity;
+    Value* fields;
 } ObjectInstance;
 
 typedef struct {
     Object object;
     Value reciever;
-    ObjectClosure* method;
+    // An ObjectClosure, or a bare ObjectFunction when the method captures
+    // nothing.
+    Object* method;
 } ObjectBoundMethod;
 
+// One function activation. closure is NULL when a bare ObjectFunction
+// (one that captures no upvalues) is executing; function is always set.
+typedef struct {
+    ObjectClosure* closure;
+    ObjectFunction* function;
+    uint8_t* ip;
+    Value* slots;
+#ifdef VM_PROFILE
+    clock_t profile_start;
+#endif
+} CallFrame;
+
+typedef enum {
+    FIBER_NEW,        // created, never resumed
+    FIBER_SUSPENDED,  // yielded, or waiting on a fiber it resumed
+    FIBER_RUNNING,
+    FIBER_DONE,
+} FiberState;
+
+// A cooperative task with its own value and frame stacks. Stacks start
+// small and grow geometrically, so thousands of idle fibers stay cheap;
+// the buffers come from the pooled allocator in memory.c and a finished
+// fiber releases them immediately, so fiber churn recycles memory
+// instead of hitting malloc.
+typedef struct ObjectFiber {
+    Object object;
+    FiberState state;
+    // Entry point, called on the first resume; an ObjectClosure or a
+    // bare ObjectFunction.
+    Object* callable;
+    // The fiber that resumed this one; control returns there on yield.
+    struct ObjectFiber* caller;
+
+    Value* stack;
+    Value* stack_top;
+    int stack_capacity;
+
+    CallFrame* frames;
+    int frame_count;
+    int frame_capacity;
+
+    // Open upvalues indexed by stack slot, parallel to the value stack.
+    ObjectUpvalue** open_upvalues;
+} ObjectFiber;
+
 void print_object(Value value);
 
 ObjectFunction*    new_function();
 ObjectUpvalue*     new_upvalue(Value* slot);
 ObjectClosure*     new_closure(ObjectFunction* function);
-ObjectNative*      new_native(NativeFn function);
+ObjectNative*      new_native(NativeFn function, const char* name, int arity, const char* params);
 ObjectClass*       new_class(ObjectString* name);
 ObjectInstance*    new_instance(ObjectClass* klass);
-ObjectBoundMethod* new_bound_method(Value reciever, ObjectClosure* method);
+ObjectBoundMethod* new_bound_method(Value reciever, Object* method);
+ObjectShape*       new_shape(ObjectShape* parent, ObjectString* name);
+ObjectRope*        new_rope(Value left, Value right);
+ObjectList*        new_list();
+ObjectFiber*       new_fiber(Object* callable);
+
+int shape_slot(ObjectShape* shape, ObjectString* name);
+ObjectShape* shape_add(ObjectShape* shape, ObjectString* name);
+ObjectString* flatten_string(Value value);
+int string_like_length(Value value);
 
 ObjectString* take_string(char* chars, int length);
 ObjectString* copy_string(const char* chars, int length);
@@ -103,6 +223,10 @@ static inline bool is_object_type(Value value, ObjectType type)
 #define IS_CLOSURE(value)      is_object_type(value, OBJECT_CLOSURE)
 #define IS_FUNCTION(value)     is_object_type(value, OBJECT_FUNCTION)
 #define IS_INSTANCE(value)     is_object_type(value, OBJECT_INSTANCE)
+#define IS_SHAPE(value)        is_object_type(value, OBJECT_SHAPE)
+#define IS_ROPE(value)         is_object_type(value, OBJECT_ROPE)
+#define IS_LIST(value)         is_object_type(value, OBJECT_LIST)
+#define IS_FIBER(value)        is_object_type(value, OBJECT_FIBER)
 #define IS_BOUND_METHOD(value) is_object_type(value, OBJECT_BOUND_METHOD)
 
 #define AS_CLASS(value)        ((ObjectClass*)AS_OBJECT(value))
@@ -113,5 +237,24 @@ static inline bool is_object_type(Value value, ObjectType type)
 #define AS_NATIVE(value)       (((ObjectNative*)AS_OBJECT(value))->function)
 #define AS_INSTANCE(value)     ((ObjectInstance*)AS_OBJECT(value))
 #define AS_BOUND_METHOD(value) ((ObjectBoundMethod*)AS_OBJECT(value))
+#define AS_SHAPE(value)        ((ObjectShape*)AS_OBJECT(value))
+#define AS_ROPE(value)         ((ObjectRope*)AS_OBJECT(value))
+#define AS_LIST(value)         ((ObjectList*)AS_OBJECT(value))
+#define AS_FIBER(value)        ((ObjectFiber*)AS_OBJECT(value))
+
+// The function behind a callable that is either an ObjectClosure or a bare
+// ObjectFunction.
+static inline ObjectFunction* callable_function(Object* callable)
+{
+    return callable->type == OBJECT_CLOSURE
+        ? ((ObjectClosure*)callable)->function
+        : (ObjectFunction*)callable;
+}
+
+// Either representation of Lox string data.
+static inline bool is_string_like(Value value)
+{
+    return IS_STRING(value) || IS_ROPE(value);
+}
 
 #endif
@@ -0,0 +1,14 @@
+#ifndef OPTIMIZER_H
+#define OPTIMIZER_H
+
+#include "chunk.h"
+
+// A function tiers up once its invocation plus loop-back-edge count
+// crosses this; see quicken_chunk().
+#define TIER_UP_HEAT 64
+
+void optimize_chunk(Chunk* chunk);
+void quicken_chunk(Chunk* chunk);
+int instruction_length(Chunk* chunk, int offset);
+
+#endif
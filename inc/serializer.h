@@ -0,0 +1,13 @@
+#ifndef SERIALIZER_H
+#define SERIALIZER_H
+
+#include "object.h"
+
+// Compiled-chunk cache. loxc_save() dumps a finished ObjectFunction tree
+// to a .loxc file next to the script; loxc_load() memory-maps it back so
+// repeated runs of an unchanged script skip the compiler entirely. Both
+// are keyed by a hash of the source, so a stale cache is simply ignored.
+ObjectFunction* loxc_load(const char* path, const char* source);
+void loxc_save(const char* path, const char* source, ObjectFunction* function);
+
+#endif
@@ -15,6 +15,9 @@ typedef struct {
     int count;
     int capacity;
     Entry* entries;
+    // One byte per slot holding a hash fragment, so probes scan a whole
+    // group of slots before touching the (much wider) entry array.
+    uint8_t* metadata;
 } Table;
 
 void table_add_all(Table* from, Table* to);
@@ -26,6 +29,6 @@ void free_table(Table* table);
 void mark_table(Table* table);
 
 ObjectString* table_find_string(Table* table, const char* chars, int length, uint32_t hash);
-void table_remove_white(Table* table);
+void table_remove_white(Table* table, bool include_old);
 
 #endif
@@ -3,10 +3,64 @@
 
 #include "common.h"
 
+#include <string.h>
+
 typedef struct Object Object;
 typedef struct ObjectString ObjectString;
 
+#ifdef NAN_BOXING
+
+// Every Value is packed into one 64-bit word. Numbers are stored as raw
+// IEEE 754 doubles; everything else lives in the quiet-NaN space, with
+// nil/true/false as tag bits and object pointers stored in the mantissa
+// under the sign bit.
+#define SIGN_BIT ((uint64_t)0x8000000000000000)
+#define QNAN     ((uint64_t)0x7ffc000000000000)
+
+#define TAG_EMPTY 0
+#define TAG_NIL   1
+#define TAG_FALSE 2
+#define TAG_TRUE  3
+
+typedef uint64_t Value;
+
+#define IS_EMPTY(value)  ((value) == EMPTY_VALUE)
+#define IS_NIL(value)    ((value) == NIL_VALUE)
+#define IS_BOOL(value)   (((value) | 1) == TRUE_VALUE)
+#define IS_NUMBER(value) (((value) & QNAN) != QNAN)
+#define IS_OBJECT(value) (((value) & (QNAN | SIGN_BIT)) == (QNAN | SIGN_BIT))
+
+// Internal sentinel for unset global slots; never visible to Lox code.
+#define EMPTY_VALUE         ((Value)(uint64_t)(QNAN | TAG_EMPTY))
+#define NIL_VALUE           ((Value)(uint64_t)(QNAN | TAG_NIL))
+#define FALSE_VALUE         ((Value)(uint64_t)(QNAN | TAG_FALSE))
+#define TRUE_VALUE          ((Value)(uint64_t)(QNAN | TAG_TRUE))
+#define BOOL_VALUE(value)   ((value) ? TRUE_VALUE : FALSE_VALUE)
+#define NUMBER_VALUE(value) number_to_value(value)
+#define OBJECT_VALUE(value) ((Value)(SIGN_BIT | QNAN | (uint64_t)(uintptr_t)(Object*)(value)))
+
+#define AS_BOOL(value)   ((value) == TRUE_VALUE)
+#define AS_NUMBER(value) value_to_number(value)
+#define AS_OBJECT(value) ((Object*)(uintptr_t)((value) & ~(SIGN_BIT | QNAN)))
+
+static inline Value number_to_value(double number)
+{
+    Value value;
+    memcpy(&value, &number, sizeof(double));
+    return value;
+}
+
+static inline double value_to_number(Value value)
+{
+    double number;
+    memcpy(&number, &value, sizeof(Value));
+    return number;
+}
+
+#else
+
 typedef enum {
+    VALUE_EMPTY,
     VALUE_NIL,
     VALUE_BOOL,
     VALUE_NUMBER,
@@ -22,11 +76,14 @@ typedef struct {
     } as;
 } Value;
 
+#define IS_EMPTY(value) ((value).type == VALUE_EMPTY)
 #define IS_NIL(value)  ((value).type == VALUE_NIL)
 #define IS_BOOL(value) ((value).type == VALUE_BOOL)
 #define IS_NUMBER(value) ((value).type == VALUE_NUMBER)
 #define IS_OBJECT(value) ((value).type == VALUE_OBJECT)
 
+// Internal sentinel for unset global slots; never visible to Lox code.
+#define EMPTY_VALUE         ((Value){VALUE_EMPTY, { .number = 0 }})
 #define NIL_VALUE           ((Value){VALUE_NIL, { .number = 0 }})
 #define BOOL_VALUE(value)   ((Value){VALUE_BOOL, { .boolean = value }})
 #define NUMBER_VALUE(value) ((Value){VALUE_NUMBER, { .number = value }})
@@ -36,6 +93,8 @@ typedef struct {
 #define AS_NUMBER(value) ((value).as.number)
 #define AS_OBJECT(value) ((value).as.object)
 
+#endif
+
 typedef struct {
     int count;
     int capacity;
@@ -5,32 +5,68 @@
 #include "table.h"
 #include "object.h"
 
+#ifdef VM_PROFILE
+#include <time.h>
+#endif
+
 #define FRAMES_MAX 64
 #define STACK_MAX (FRAMES_MAX * UINT8_COUNT)
 
-typedef struct {
-    ObjectClosure* closure;
-    uint8_t* ip;
-    Value* slots;
-} CallFrame;
-
-typedef struct {
-    int frame_count;
-    CallFrame frames[STACK_MAX];
-    Value stack[STACK_MAX];
-    Value* stack_top;
-    Object* objects;
+typedef struct VM VM;
+
+// Invoked after every collection cycle with the pause it cost, so embedders
+// can export GC metrics without compiling with DEBUG_LOG_GC.
+typedef void (*GcCycleHook)(VM* isolate, bool major, double pause_seconds);
+
+struct VM {
+    // The fiber currently executing; its caller chain leads back to the
+    // main fiber, which interpret() runs the script on.
+    ObjectFiber* fiber;
+    // Roots a value while a stack push grows the fiber's stack.
+    Value push_guard;
+    Object* objects;      // young generation
+    Object* old_objects;  // promoted survivors
+    int remembered_count;
+    int remembered_capacity;
+    Object** remembered;
     Table strings;
-    Table globals;
-    ObjectUpvalue* open_upvalues;
+    Table global_names;
+    ValueArray global_slots;
     int gray_count;
     int gray_capacity;
     Object** gray_stack;
     ObjectString* init_string;
+    ObjectShape* root_shape;
+    // The REPL's pooled top-level function: interpret_repl() compiles
+    // every line into it instead of allocating a fresh script function,
+    // keeping its chunk buffers warm across the session.
+    ObjectFunction* repl_function;
 
     size_t bytes_allocated;
     size_t next_gc;
-} VM;
+    size_t next_minor_gc;
+    // While positive, reallocate() defers collections entirely; the
+    // compiler holds this across a compilation so the heap it is building
+    // is never traced mid-flight. The deferred collection happens on the
+    // first allocation after release.
+    int gc_paused;
+    // Heap growth factor applied after a full collection; tunable at
+    // runtime (together with next_gc) via the gcTune() native.
+    double gc_grow_factor;
+
+    // GC observability: cycle counts and pause accounting in seconds,
+    // measured with clock(). Exposed to scripts through gcStats().
+    int gc_minor_cycles;
+    int gc_major_cycles;
+    double gc_total_pause;
+    double gc_max_pause;
+    GcCycleHook gc_cycle_hook;
+
+#ifdef VM_PROFILE
+    // One execution counter per opcode, bumped in the dispatch loop.
+    uint64_t opcode_counts[OP_CODE_COUNT];
+#endif
+};
 
 typedef enum {
     INTERPRET_OK,
@@ -41,9 +77,24 @@ typedef enum {
 void init_vm();
 void free_vm();
 void stack_push(Value value);
+int vm_global_slot(ObjectString* name);
+ObjectString* global_name(int slot);
 Value stack_pop();
 InterpretResult interpret(const char* source);
+// interpret() for REPL lines: reuses the session's pooled top-level
+// function across calls; see compile_repl().
+InterpretResult interpret_repl(const char* source);
+InterpretResult interpret_function(ObjectFunction* function);
+
+// Isolate API. Each VM is fully independent (own heap, own GC, own interned
+// strings), so N threads can each create and drive their own. A VM may only
+// be used by one thread at a time; vm_interpret() binds it to the calling
+// thread for the duration of the run.
+VM* vm_create();
+InterpretResult vm_interpret(VM* isolate, const char* source);
+void vm_destroy(VM* isolate);
 
-extern VM vm;
+// The VM the current thread is operating on.
+extern CLOX_THREAD_LOCAL VM* vm;
 
 #endif
@@ -9,6 +9,9 @@ void init_chunk(Chunk* chunk)
     chunk->capacity = 0;
     chunk->code = NULL;
     chunk->lines = NULL;
+    chunk->mapped = false;
+    chunk->caches = NULL;
+    chunk->invoke_caches = NULL;
     init_value_array(&chunk->constants);
 }
 
@@ -36,8 +39,16 @@ int add_constant(Chunk* chunk, Value value)
 
 void free_chunk(Chunk* chunk)
 {
-    FREE_ARRAY(uint8_t, chunk->code, chunk->capacity);
-    FREE_ARRAY(int, chunk->lines, chunk->capacity);
+    if (!chunk->mapped) {
+        FREE_ARRAY(uint8_t, chunk->code, chunk->capacity);
+        FREE_ARRAY(int, chunk->lines, chunk->capacity);
+    }
+    if (chunk->caches != NULL) {
+        FREE_ARRAY(PropertyCache, chunk->caches, chunk->count);
+    }
+    if (chunk->invoke_caches != NULL) {
+        FREE_ARRAY(InvokeCache, chunk->invoke_caches, chunk->count);
+    }
     free_value_array(&chunk->constants);
     init_chunk(chunk);
 }
@@ -8,6 +8,7 @@
 
 #include "scanner.h"
 #include "compiler.h"
+#include "optimizer.h"
 
 #include <string.h>
 #include <stdlib.h>
@@ -46,13 +47,27 @@ typedef struct {
     Token name;
     int depth;
     bool is_captured;
+    bool is_mutated;
 } Local;
 
 typedef struct {
     uint8_t index;
     bool is_local;
+    // A deeper function reaches this capture through its own upvalue, so
+    // it must stay boxed even if the variable is never assigned.
+    bool recaptured;
 } Upvalue;
 
+// One direct capture of a local by a nested function. Whether it can be
+// flattened is only known once the local dies, so the decision is deferred
+// until then; the nested function's bytecode is rewritten in place.
+typedef struct {
+    uint8_t constant;     // OP_CLOSURE operand, to find the site again
+    uint8_t local_slot;   // the captured local in this function
+    uint8_t upvalue_slot; // the capture's slot in the nested function
+    ObjectFunction* function;
+} FlatCandidate;
+
 typedef enum {
     TYPE_SCRIPT,
     TYPE_FUNCTION,
@@ -68,6 +83,11 @@ typedef struct Compiler {
     Local locals[UINT8_COUNT];
     int local_count;
     int scope_depth;
+
+    FlatCandidate* flat_candidates;
+    int flat_count;
+    int flat_capacity;
+
     struct Compiler* enclosing;
 } Compiler;
 
@@ -77,10 +97,57 @@ typedef struct ClassCompiler {
     struct ClassCompiler* enclosing;
 } ClassCompiler;
 
-static Parser parser;
-static Chunk* compiling_chunk;
-static ClassCompiler* current_class = NULL;
-static Compiler* current = NULL;
+static CLOX_THREAD_LOCAL Parser parser;
+static CLOX_THREAD_LOCAL Chunk* compiling_chunk;
+static CLOX_THREAD_LOCAL ClassCompiler* current_class = NULL;
+static CLOX_THREAD_LOCAL Compiler* current = NULL;
+
+// Transient compile-time data (the flat-capture worklists) comes from a
+// bump arena rather than the GC-tracked heap: blocks are carved with a
+// pointer increment, grown arrays just abandon their old copy, and the
+// whole arena is returned to the system in one shot when the top-level
+// compilation ends. Nothing in it outlives compile().
+#define ARENA_BLOCK_SIZE 8192
+
+typedef struct ArenaBlock {
+    struct ArenaBlock* next;
+    size_t used;
+    size_t capacity;
+} ArenaBlock;
+
+static CLOX_THREAD_LOCAL ArenaBlock* arena = NULL;
+
+static void* arena_alloc(size_t size)
+{
+    size = (size + sizeof(void*) - 1) & ~(sizeof(void*) - 1);
+    if (arena == NULL || arena->used + size > arena->capacity) {
+        size_t capacity = ARENA_BLOCK_SIZE - sizeof(ArenaBlock);
+        if (capacity < size)
+            capacity = size;
+        ArenaBlock* block = (ArenaBlock*)malloc(sizeof(ArenaBlock) + capacity);
+        if (block == NULL) {
+            fprintf(stderr, "Not enough memory to compile.\n");
+            exit(74);
+        }
+        block->next     = arena;
+        block->used     = 0;
+        block->capacity = capacity;
+        arena = block;
+    }
+
+    void* result = (char*)(arena + 1) + arena->used;
+    arena->used += size;
+    return result;
+}
+
+static void arena_release()
+{
+    while (arena != NULL) {
+        ArenaBlock* next = arena->next;
+        free(arena);
+        arena = next;
+    }
+}
 
 static Chunk* current_chunk()
 {
@@ -161,6 +228,10 @@ static uint8_t make_constant(Value value)
         return 0;
     }
 
+    // The function can be old while the constant is young: the REPL's
+    // pooled function survives collections between submissions. The
+    // barrier keeps its constants visible to later minor collections.
+    gc_write_barrier((Object*)current->function, value);
     return (uint8_t)constant;
 }
 
@@ -193,7 +264,7 @@ static int emit_jump(uint8_t instruction)
     emit_byte(instruction);
     emit_byte(0xff);
     emit_byte(0xff);
-    return current_chunk()->count - 1;
+    return current_chunk()->count - 2;
 }
 
 static void emit_constant(Value value)
@@ -201,6 +272,95 @@ static void emit_constant(Value value)
     emit_bytes(OP_CONSTANT, make_constant(value));
 }
 
+// Offset of the first byte of the expression parse_precedence() most recently
+// started; infix handlers read it to locate their left operand for folding.
+static CLOX_THREAD_LOCAL int last_operand_start = -1;
+
+// If the code in [start, end) is a single constant-producing instruction,
+// store its value and return true.
+static bool constant_region(int start, int end, Value* value)
+{
+    Chunk* chunk = current_chunk();
+    if (end - start == 1) {
+        switch (chunk->code[start]) {
+        case OP_NIL:   *value = NIL_VALUE;         return true;
+        case OP_TRUE:  *value = BOOL_VALUE(true);  return true;
+        case OP_FALSE: *value = BOOL_VALUE(false); return true;
+        }
+        return false;
+    }
+    if (end - start == 2 && chunk->code[start] == OP_CONSTANT) {
+        *value = chunk->constants.values[chunk->code[start + 1]];
+        return true;
+    }
+    return false;
+}
+
+// Replace the code from `start` onward with a single instruction producing
+// `value`. The operands' pool entries are left behind, which wastes a slot
+// but keeps every already-emitted constant index valid.
+static void emit_folded(int start, Value value)
+{
+    current_chunk()->count = start;
+    if (IS_NIL(value)) {
+        emit_byte(OP_NIL);
+    } else if (IS_BOOL(value)) {
+        emit_byte(AS_BOOL(value) ? OP_TRUE : OP_FALSE);
+    } else {
+        emit_constant(value);
+    }
+}
+
+static bool value_is_falsey(Value value)
+{
+    return IS_NIL(value) || (IS_BOOL(value) && !AS_BOOL(value));
+}
+
+static bool fold_binary(TokenType op_type, Value left, Value right, Value* result)
+{
+    if (IS_NUMBER(left) && IS_NUMBER(right)) {
+        double a = AS_NUMBER(left);
+        double b = AS_NUMBER(right);
+        switch (op_type) {
+        case TOKEN_PLUS:          *result = NUMBER_VALUE(a + b); return true;
+        case TOKEN_MINUS:         *result = NUMBER_VALUE(a - b); return true;
+        case TOKEN_STAR:          *result = NUMBER_VALUE(a * b); return true;
+        case TOKEN_SLASH:         *result = NUMBER_VALUE(a / b); return true;
+        case TOKEN_GREATER:       *result = BOOL_VALUE(a > b);   return true;
+        case TOKEN_GREATER_EQUAL: *result = BOOL_VALUE(a >= b);  return true;
+        case TOKEN_LESS:          *result = BOOL_VALUE(a < b);   return true;
+        case TOKEN_LESS_EQUAL:    *result = BOOL_VALUE(a <= b);  return true;
+        case TOKEN_PERCENT:
+            // OP_MODULO truncates to int; a zero divisor stays a runtime
+            // problem rather than becoming a compile-time one.
+            if ((int)b == 0) return false;
+            *result = NUMBER_VALUE((double)((int)a % (int)b));
+            return true;
+        default: break;
+        }
+    }
+
+    if (op_type == TOKEN_PLUS && IS_STRING(left) && IS_STRING(right)) {
+        ObjectString* a = AS_STRING(left);
+        ObjectString* b = AS_STRING(right);
+        int length = a->length + b->length;
+        char* chars = ALLOCATE(char, length + 1);
+        memcpy(chars, a->chars, a->length);
+        memcpy(chars + a->length, b->chars, b->length);
+        chars[length] = '\0';
+        *result = OBJECT_VALUE(take_string(chars, length));
+        return true;
+    }
+
+    if (op_type == TOKEN_EQUAL_EQUAL || op_type == TOKEN_BANG_EQUAL) {
+        bool equal = values_equal(left, right);
+        *result = BOOL_VALUE(op_type == TOKEN_EQUAL_EQUAL ? equal : !equal);
+        return true;
+    }
+
+    return false;
+}
+
 static void patch_jump(int offset)
 {
     // -2 to adjust for the bytecode for the jump offset itself.
@@ -222,23 +382,32 @@ static void emit_return()
     emit_byte(OP_RETURN);
 }
 
-static void init_compiler(Compiler* compiler, FunctionType type)
+// 'function' is freshly allocated for every compilation except REPL
+// lines, which reuse the session's pooled script function.
+static void init_compiler_reusing(Compiler* compiler, FunctionType type, ObjectFunction* function)
 {
     compiler->enclosing   = current;
     compiler->type        = type;
-    compiler->function    = NULL;
+    compiler->function    = function;
     compiler->local_count = 0;
     compiler->scope_depth = 0;
-    compiler->function    = new_function();
+
+    compiler->flat_candidates = NULL;
+    compiler->flat_count      = 0;
+    compiler->flat_capacity   = 0;
 
     current = compiler;
 
     if (type != TYPE_SCRIPT) {
         current->function->name = copy_string(parser.previous.start, parser.previous.length);
+        // The interned name may predate the function by many collections;
+        // if it is ever the younger of the two, the barrier records it.
+        gc_write_barrier((Object*)current->function, OBJECT_VALUE(current->function->name));
     }
 
     Local* local = &current->locals[current->local_count++];
     local->is_captured = false;
+    local->is_mutated  = false;
     local->depth       = 0;
 
     if (type != TYPE_FUNCTION) {
@@ -250,10 +419,98 @@ static void init_compiler(Compiler* compiler, FunctionType type)
     }
 }
 
+static void init_compiler(Compiler* compiler, FunctionType type)
+{
+    init_compiler_reusing(compiler, type, new_function());
+}
+
+static void add_flat_candidate(uint8_t constant, uint8_t local_slot,
+                               uint8_t upvalue_slot, ObjectFunction* function)
+{
+    if (current->flat_count == current->flat_capacity) {
+        int old_capacity = current->flat_capacity;
+        current->flat_capacity = GROW_CAPACITY(old_capacity);
+        FlatCandidate* grown =
+            (FlatCandidate*)arena_alloc(sizeof(FlatCandidate) * current->flat_capacity);
+        // The first growth starts from NULL, which memcpy must not see.
+        if (old_capacity > 0) {
+            memcpy(grown, current->flat_candidates, sizeof(FlatCandidate) * old_capacity);
+        }
+        current->flat_candidates = grown;
+    }
+
+    FlatCandidate* candidate = &current->flat_candidates[current->flat_count++];
+    candidate->constant     = constant;
+    candidate->local_slot   = local_slot;
+    candidate->upvalue_slot = upvalue_slot;
+    candidate->function     = function;
+}
+
+static void rewrite_flat_upvalue(ObjectFunction* function, uint8_t slot)
+{
+    Chunk* chunk = &function->chunk;
+    for (int offset = 0; offset < chunk->count; offset += instruction_length(chunk, offset)) {
+        if (chunk->code[offset] == OP_GET_UPVALUE && chunk->code[offset + 1] == slot) {
+            chunk->code[offset] = OP_GET_UPVALUE_FLAT;
+        }
+    }
+}
+
+// The OP_CLOSURE site is found by walking instruction boundaries rather
+// than by a remembered offset: constant folding can truncate and re-emit
+// code, so an offset alone is not trustworthy. A site inside an elided
+// branch is simply never found and the capture stays boxed.
+static void apply_flat_candidate(FlatCandidate* candidate)
+{
+    Chunk* chunk = current_chunk();
+    for (int offset = 0; offset < chunk->count; offset += instruction_length(chunk, offset)) {
+        if (chunk->code[offset] == OP_CLOSURE && chunk->code[offset + 1] == candidate->constant) {
+            chunk->code[offset + 2 + candidate->upvalue_slot * 2] = 2;
+            rewrite_flat_upvalue(candidate->function, candidate->upvalue_slot);
+            return;
+        }
+    }
+}
+
+// Called when the local in 'slot' goes out of scope; no assignment to it
+// can compile after this point, so its captures can be settled.
+static void flatten_captures_of(uint8_t slot, bool mutated)
+{
+    int kept = 0;
+    for (int i = 0; i < current->flat_count; i++) {
+        FlatCandidate* candidate = &current->flat_candidates[i];
+        if (candidate->local_slot != slot) {
+            current->flat_candidates[kept++] = *candidate;
+            continue;
+        }
+
+        if (!mutated && !parser.hadError) {
+            apply_flat_candidate(candidate);
+        }
+    }
+    current->flat_count = kept;
+}
+
 static ObjectFunction* end_compiler()
 {
     emit_return();
     ObjectFunction* function = current->function;
+
+    // Parameters and the reserved slot never hit end_scope(); settle any
+    // captures of them before the optimizer moves the code around.
+    for (int i = 0; i < current->local_count; i++) {
+        if (current->locals[i].is_captured) {
+            flatten_captures_of((uint8_t)i, current->locals[i].is_mutated);
+        }
+    }
+    // flat_candidates lives in the arena; it is freed with everything
+    // else when the top-level compilation ends.
+
+    // Jump operands are only trustworthy once compilation succeeded.
+    if (!parser.hadError) {
+        optimize_chunk(current_chunk());
+    }
+
 #   ifdef DEBUG_PRINT_CODE
     if (!parser.hadError) {
         disassemble_chunk(current_chunk(), function->name != NULL ? function->name->chars : "<script>");
@@ -274,7 +531,9 @@ static void end_scope()
     current->scope_depth--;
 
     while (current->local_count > 0 && current->locals[current->local_count - 1].depth > current->scope_depth) {
-        if (current->locals[current->local_count - 1].is_captured) {
+        Local* local = &current->locals[current->local_count - 1];
+        if (local->is_captured) {
+            flatten_captures_of((uint8_t)(current->local_count - 1), local->is_mutated);
             emit_byte(OP_CLOSE_UPVALUE);
         } else {
             emit_byte(OP_POP);
@@ -301,11 +560,13 @@ static void parse_precedence(Precedence precedence)
     }
 
     bool can_assign = precedence <= PREC_ASSIGNMENT;
+    int start = current_chunk()->count;
     prefix_rule(can_assign);
 
     while (precedence <= get_rule(parser.current.type)->precedence) {
         advance();
         ParseFn infix_rule = get_rule(parser.previous.type)->infix;
+        last_operand_start = start;
         infix_rule(can_assign);
     }
 
@@ -321,6 +582,17 @@ static uint8_t identifier_constant(Token* name)
     );
 }
 
+static uint8_t global_slot(Token* name)
+{
+    int slot = vm_global_slot(copy_string(name->start, name->length));
+    if (slot > UINT8_MAX) {
+        error("Too many global variables.");
+        return 0;
+    }
+
+    return (uint8_t)slot;
+}
+
 static bool identifiers_equal(Token* a, Token* b)
 {
     if (a->length != b->length)
@@ -358,8 +630,9 @@ static int add_upvalue(Compiler* compiler, uint8_t index, bool is_local)
         return 0;
     }
 
-    compiler->upvalues[upvalue_count].is_local = is_local;
-    compiler->upvalues[upvalue_count].index    = index;
+    compiler->upvalues[upvalue_count].is_local   = is_local;
+    compiler->upvalues[upvalue_count].index      = index;
+    compiler->upvalues[upvalue_count].recaptured = false;
     return compiler->function->upvalue_count++;
 }
 
@@ -375,12 +648,25 @@ static int resolve_upvalue(Compiler* compiler, Token* name)
 
     int upvalue = resolve_upvalue(compiler->enclosing, name);
     if (upvalue != -1) {
+        compiler->enclosing->upvalues[upvalue].recaptured = true;
         return add_upvalue(compiler, (uint8_t)upvalue, false);
     }
 
     return -1;
 }
 
+// An assignment through an upvalue mutates the local at the root of the
+// capture chain; find it and mark it so none of its captures flatten.
+static void mark_upvalue_assigned(Compiler* compiler, int slot)
+{
+    Upvalue* upvalue = &compiler->upvalues[slot];
+    if (upvalue->is_local) {
+        compiler->enclosing->locals[upvalue->index].is_mutated = true;
+    } else {
+        mark_upvalue_assigned(compiler->enclosing, upvalue->index);
+    }
+}
+
 static void add_local(Token name)
 {
     if (current->local_count == UINT8_COUNT) {
@@ -390,6 +676,7 @@ static void add_local(Token name)
 
     Local* local = &current->locals[current->local_count++];
     local->is_captured = false;
+    local->is_mutated  = false;
     local->name        = name;
     local->depth       = -1;
 }
@@ -420,7 +707,7 @@ static uint8_t parse_variable(const char* error_message)
     if (current->scope_depth > 0) 
         return 0;
 
-    return identifier_constant(&parser.previous);
+    return global_slot(&parser.previous);
 }
 
 static void mark_initialized()
@@ -453,12 +740,17 @@ static void named_variable(Token name, bool can_assign)
         setOp = OP_SET_UPVALUE;
     }
     else {
-        arg = identifier_constant(&name);
+        arg = global_slot(&name);
         getOp = OP_GET_GLOBAL;
         setOp = OP_SET_GLOBAL;
     }
 
     if (can_assign && match(TOKEN_EQUAL)) {
+        if (setOp == OP_SET_LOCAL) {
+            current->locals[arg].is_mutated = true;
+        } else if (setOp == OP_SET_UPVALUE) {
+            mark_upvalue_assigned(current, arg);
+        }
         expression();
         emit_bytes(setOp, (uint8_t)arg);
     }
@@ -550,11 +842,27 @@ static void function(FunctionType type)
     block();
 
     ObjectFunction* function = end_compiler();
-    emit_bytes(OP_CLOSURE, make_constant(OBJECT_VALUE(function)));
+
+    // A function that captures nothing needs no closure: load it like any
+    // other constant and let call_value() run it bare.
+    if (function->upvalue_count == 0) {
+        emit_constant(OBJECT_VALUE(function));
+        return;
+    }
+
+    uint8_t constant = make_constant(OBJECT_VALUE(function));
+    emit_bytes(OP_CLOSURE, constant);
 
     for (int i = 0; i < function->upvalue_count; i++) {
         emit_byte(compiler.upvalues[i].is_local ? 1 : 0);
         emit_byte(compiler.upvalues[i].index);
+
+        // The function body is fully compiled here, so recaptured is
+        // final; whether the local is ever assigned is not, so the
+        // flattening decision waits until the local's scope ends.
+        if (compiler.upvalues[i].is_local && !compiler.upvalues[i].recaptured) {
+            add_flat_candidate(constant, compiler.upvalues[i].index, (uint8_t)i, function);
+        }
     }
 }
 
@@ -608,7 +916,7 @@ static void class_declaration()
     declare_variable();
 
     emit_bytes(OP_CLASS, name_constant);
-    define_variable(name_constant);
+    define_variable(current->scope_depth > 0 ? 0 : global_slot(&class_name));
 
     ClassCompiler class_compiler;
     class_compiler.has_superclass = false;
@@ -656,11 +964,24 @@ static void binary(bool can_assign)
 {
     // Remember the operator.
     TokenType op_type = parser.previous.type;
+    int left_start = last_operand_start;
 
     // Compile the right operand.
     ParseRule* rule = get_rule(op_type);
+    int right_start = current_chunk()->count;
     parse_precedence((Precedence)(rule->precedence + 1));
 
+    // If both operands compiled to constants, apply the operator now and
+    // replace the whole expression with the result.
+    Value left, right, folded;
+    if (left_start >= 0 &&
+        constant_region(left_start, right_start, &left) &&
+        constant_region(right_start, current_chunk()->count, &right) &&
+        fold_binary(op_type, left, right, &folded)) {
+        emit_folded(left_start, folded);
+        return;
+    }
+
     // Emit the operator instruction.
     switch (op_type) {
     case TOKEN_PLUS:          emit_byte(OP_ADD);              break;
@@ -702,10 +1023,51 @@ static void dot(bool can_assign)
     }
 }
 
+static void list_literal(bool can_assign)
+{
+    // Build incrementally: the list is created empty and each element is
+    // appended as it is compiled, so literals have no length limit.
+    emit_bytes(OP_BUILD_LIST, 0);
+    if (!check(TOKEN_RIGHT_BRACKET)) {
+        do {
+            expression();
+            emit_byte(OP_LIST_APPEND);
+        } while (match(TOKEN_COMMA));
+    }
+    consume(TOKEN_RIGHT_BRACKET, "Expected ']' after list elements.");
+}
+
+static void index_(bool can_assign)
+{
+    expression();
+    consume(TOKEN_RIGHT_BRACKET, "Expected ']' after index.");
+
+    if (can_assign && match(TOKEN_EQUAL)) {
+        expression();
+        emit_byte(OP_INDEX_SET);
+    } else {
+        emit_byte(OP_INDEX_GET);
+    }
+}
+
 static void unary(bool can_assign)
 {
     TokenType operator_type = parser.previous.type;
+    int operand_start = current_chunk()->count;
     parse_precedence(PREC_UNARY);
+
+    Value operand;
+    if (constant_region(operand_start, current_chunk()->count, &operand)) {
+        if (operator_type == TOKEN_MINUS && IS_NUMBER(operand)) {
+            emit_folded(operand_start, NUMBER_VALUE(-AS_NUMBER(operand)));
+            return;
+        }
+        if (operator_type == TOKEN_BANG) {
+            emit_folded(operand_start, BOOL_VALUE(value_is_falsey(operand)));
+            return;
+        }
+    }
+
     switch (operator_type) {
     case TOKEN_BANG:  emit_byte(OP_NOT);    break;
     case TOKEN_MINUS: emit_byte(OP_NEGATE); break;
@@ -776,6 +1138,21 @@ static void this_(bool can_assign)
     variable(false);
 }
 
+// 'yield' is an expression: the operand (nil when omitted) goes to the
+// fiber's resumer, and the value of the next resume comes back as the
+// expression's result. Whether a yield is legal depends on the fiber the
+// function eventually runs on, so it is checked at runtime, not here.
+static void yield_(bool can_assign)
+{
+    if (check(TOKEN_SEMICOLON) || check(TOKEN_RIGHT_PAREN) ||
+        check(TOKEN_RIGHT_BRACE) || check(TOKEN_COMMA)) {
+        emit_byte(OP_NIL);
+    } else {
+        parse_precedence(PREC_ASSIGNMENT);
+    }
+    emit_byte(OP_YIELD);
+}
+
 static void print_statement()
 {
     expression();
@@ -796,8 +1173,21 @@ static void return_statement()
             error("Can't return from an initializer.");
         }
 
+        int value_start = current_chunk()->count;
         expression();
         consume(TOKEN_SEMICOLON, "Expected ';' after return value.");
+
+        // A call whose result is returned unchanged is in tail position:
+        // rewrite it in place so the VM reuses the current frame.
+        Chunk* chunk = current_chunk();
+        int last = value_start;
+        for (int offset = value_start; offset < chunk->count; )  {
+            last = offset;
+            offset += instruction_length(chunk, offset);
+        }
+        if (chunk->code[last] == OP_CALL)   chunk->code[last] = OP_TAIL_CALL;
+        if (chunk->code[last] == OP_INVOKE) chunk->code[last] = OP_TAIL_INVOKE;
+
         emit_byte(OP_RETURN);
     }
 }
@@ -812,9 +1202,33 @@ static void expression_statement()
 static void if_statement()
 {
     consume(TOKEN_LEFT_PAREN, "Expected '(' after 'if'.");
+    int condition_start = current_chunk()->count;
     expression();
     consume(TOKEN_RIGHT_PAREN, "Expected ')' after condition.");
 
+    Value condition;
+    if (constant_region(condition_start, current_chunk()->count, &condition)) {
+        // The branch is static: drop the condition and keep only the arm
+        // that can run. The dead arm is still parsed (for errors and scope
+        // bookkeeping) and its code discarded afterwards.
+        current_chunk()->count = condition_start;
+        if (!value_is_falsey(condition)) {
+            statement();
+            if (match(TOKEN_ELSE)) {
+                int dead = current_chunk()->count;
+                statement();
+                current_chunk()->count = dead;
+            }
+        } else {
+            int dead = current_chunk()->count;
+            statement();
+            current_chunk()->count = dead;
+            if (match(TOKEN_ELSE))
+                statement();
+        }
+        return;
+    }
+
     int then_jump = emit_jump(OP_JUMP_IF_FALSE);
     emit_byte(OP_POP);
     statement();
@@ -958,6 +1372,8 @@ static void declaration()
 
 static ParseRule rules[] = {
   [TOKEN_LEFT_PAREN]    = {grouping, call,   PREC_CALL},
+  [TOKEN_LEFT_BRACKET]  = {list_literal, index_, PREC_CALL},
+  [TOKEN_RIGHT_BRACKET] = {NULL,     NULL,   PREC_NONE},
   [TOKEN_RIGHT_PAREN]   = {NULL,     NULL,   PREC_NONE},
   [TOKEN_LEFT_BRACE]    = {NULL,     NULL,   PREC_NONE},
   [TOKEN_RIGHT_BRACE]   = {NULL,     NULL,   PREC_NONE},
@@ -979,8 +1395,8 @@ static ParseRule rules[] = {
   [TOKEN_LESS_EQUAL]    = {NULL,     binary, PREC_COMPARISON},
   [TOKEN_IDENTIFIER]    = {variable, NULL,   PREC_NONE},
   [TOKEN_STRING]        = {string,   NULL,   PREC_NONE},
-  [TOKEN_NUMBER]        = {number,   and_,   PREC_AND},
-  [TOKEN_AND]           = {NULL,     NULL,   PREC_NONE},
+  [TOKEN_NUMBER]        = {number,   NULL,   PREC_NONE},
+  [TOKEN_AND]           = {NULL,     and_,   PREC_AND},
   [TOKEN_CLASS]         = {NULL,     NULL,   PREC_NONE},
   [TOKEN_ELSE]          = {NULL,     NULL,   PREC_NONE},
   [TOKEN_FALSE]         = {literal,  NULL,   PREC_NONE},
@@ -996,6 +1412,7 @@ static ParseRule rules[] = {
   [TOKEN_TRUE]          = {literal,  NULL,   PREC_NONE},
   [TOKEN_VAR]           = {NULL,     NULL,   PREC_NONE},
   [TOKEN_WHILE]         = {NULL,     NULL,   PREC_NONE},
+  [TOKEN_YIELD]         = {yield_,   NULL,   PREC_NONE},
   [TOKEN_ERROR]         = {NULL,     NULL,   PREC_NONE},
   [TOKEN_EOF]           = {NULL,     NULL,   PREC_NONE},
 };
@@ -1009,6 +1426,13 @@ ObjectFunction* compile(const char* source)
 {
     init_scanner(source);
 
+    // With collections deferred for the whole compilation, nothing the
+    // compiler allocates — functions, chunks, interned identifiers — can
+    // be traced or swept mid-flight, so the compile phase costs the GC
+    // nothing. The deferred collection runs on the first allocation
+    // after release, with the finished function reachable as a root.
+    vm->gc_paused++;
+
     Compiler compiler;
     init_compiler(&compiler, TYPE_SCRIPT);
 
@@ -1023,6 +1447,67 @@ ObjectFunction* compile(const char* source)
 
     ObjectFunction* function = end_compiler();
 
+    vm->gc_paused--;
+    arena_release();
+
+    return parser.hadError ? NULL : function;
+}
+
+// Compiles one REPL submission into the session's pooled script
+// function instead of allocating a fresh one per line. The chunk's
+// buffers are emptied but kept, the inline caches are dropped (their
+// sites no longer line up with the new code), and the tier state is
+// reset so the new line starts cold. Identifiers interned and global
+// slots assigned by earlier lines are in vm->strings and
+// vm->global_names, so they resolve without re-registration, and
+// make_constant()'s write barrier covers young constants entering the
+// promoted function.
+ObjectFunction* compile_repl(const char* source)
+{
+    ObjectFunction* function = vm->repl_function;
+    if (function == NULL) {
+        function = compile(source);
+        if (function != NULL) {
+            vm->repl_function = function;
+        }
+        return function;
+    }
+
+    Chunk* chunk = &function->chunk;
+    if (chunk->caches != NULL) {
+        FREE_ARRAY(PropertyCache, chunk->caches, chunk->count);
+        chunk->caches = NULL;
+    }
+    if (chunk->invoke_caches != NULL) {
+        FREE_ARRAY(InvokeCache, chunk->invoke_caches, chunk->count);
+        chunk->invoke_caches = NULL;
+    }
+    chunk->count           = 0;
+    chunk->constants.count = 0;
+    function->heat   = 0;
+    function->tiered = false;
+
+    init_scanner(source);
+
+    vm->gc_paused++;
+
+    Compiler compiler;
+    init_compiler_reusing(&compiler, TYPE_SCRIPT, function);
+
+    parser.hadError  = false;
+    parser.panicMode = false;
+
+    advance();
+
+    while (!match(TOKEN_EOF)) {
+        declaration();
+    }
+
+    end_compiler();
+
+    vm->gc_paused--;
+    arena_release();
+
     return parser.hadError ? NULL : function;
 }
 
@@ -1,6 +1,7 @@
 #include "debug.h"
 #include "value.h"
 #include "object.h"
+#include "vm.h"
 
 #include <stdio.h>
 
@@ -34,6 +35,24 @@ static int constant_instruction(const char* name, Chunk* chunk, int offset)
     return offset + 2;
 }
 
+static int byte_byte_instruction(const char* name, Chunk* chunk, int offset)
+{
+    uint8_t slot_a = chunk->code[offset + 1];
+    uint8_t slot_b = chunk->code[offset + 2];
+    printf("%-16s %4d %4d\n", name, slot_a, slot_b);
+    return offset + 3;
+}
+
+static int constant_byte_instruction(const char* name, Chunk* chunk, int offset)
+{
+    uint8_t constant = chunk->code[offset + 1];
+    uint8_t arg      = chunk->code[offset + 2];
+    printf("%-16s %4d '", name, constant);
+    print_value(chunk->constants.values[constant]);
+    printf("' %4d\n", arg);
+    return offset + 3;
+}
+
 static int invoke_instruction(const char* name, Chunk* chunk, int offset)
 {
     uint8_t constant = chunk->code[offset + 1];
@@ -75,21 +94,38 @@ int disassemble_instruction(Chunk* chunk, int offset)
     case OP_MULTIPLY:      return simple_instruction("OP_MULTIPLY", offset);
     case OP_INVOKE:        return invoke_instruction("OP_INVOKE", chunk, offset);
     case OP_SUPER_INVOKE:  return invoke_instruction("OP_SUPER_INVOKE", chunk, offset);
+    case OP_TAIL_INVOKE:   return invoke_instruction("OP_TAIL_INVOKE", chunk, offset);
     case OP_CALL:          return byte_instruction("OP_CALL", chunk, offset);
+    case OP_TAIL_CALL:     return byte_instruction("OP_TAIL_CALL", chunk, offset);
     case OP_GET_LOCAL:     return byte_instruction("OP_GET_LOCAL", chunk, offset);
     case OP_SET_LOCAL:     return byte_instruction("OP_SET_LOCAL", chunk, offset);
     case OP_GET_UPVALUE:   return byte_instruction("OP_GET_UPVALUE", chunk, offset);
+    case OP_GET_UPVALUE_FLAT: return byte_instruction("OP_GET_UPVALUE_FLAT", chunk, offset);
     case OP_SET_UPVALUE:   return byte_instruction("OP_SET_UPVALUE", chunk, offset);
     case OP_CLOSE_UPVALUE: return simple_instruction("OP_CLOSE_UPVALUE", offset);
+    case OP_YIELD:         return simple_instruction("OP_YIELD", offset);
     case OP_CLASS:         return constant_instruction("OP_CLASS", chunk, offset);
     case OP_METHOD:        return constant_instruction("OP_METHOD", chunk, offset);
     case OP_CONSTANT:      return constant_instruction("OP_CONSTANT", chunk, offset);
-    case OP_SET_GLOBAL:    return constant_instruction("OP_SET_GLOBAL", chunk, offset);
-    case OP_GET_GLOBAL:    return constant_instruction("OP_GET_GLOBAL", chunk, offset);
-    case OP_DEFINE_GLOBAL: return constant_instruction("OP_DEFINE_GLOBAL", chunk, offset);
+    case OP_SET_GLOBAL:    return byte_instruction("OP_SET_GLOBAL", chunk, offset);
+    case OP_GET_GLOBAL:    return byte_instruction("OP_GET_GLOBAL", chunk, offset);
+    case OP_DEFINE_GLOBAL: return byte_instruction("OP_DEFINE_GLOBAL", chunk, offset);
     case OP_GET_PROPERTY:  return constant_instruction("OP_GET_PROPERTY", chunk, offset);
     case OP_SET_PROPERTY:  return constant_instruction("OP_SET_PROPERTY", chunk, offset);
     case OP_JUMP_IF_FALSE: return jump_instruction("OP_JUMP_IF_FALSE", 1, chunk, offset);
+    case OP_LESS_JUMP:     return jump_instruction("OP_LESS_JUMP", 1, chunk, offset);
+    case OP_GREATER_JUMP:  return jump_instruction("OP_GREATER_JUMP", 1, chunk, offset);
+    case OP_EQUAL_JUMP:    return jump_instruction("OP_EQUAL_JUMP", 1, chunk, offset);
+    case OP_GET_LOCAL_GET_LOCAL: return byte_byte_instruction("OP_GET_LOCAL_GET_LOCAL", chunk, offset);
+    case OP_ADD_CONSTANT:  return constant_instruction("OP_ADD_CONSTANT", chunk, offset);
+    case OP_ADD_NUMBER:    return simple_instruction("OP_ADD_NUMBER", offset);
+    case OP_ADD_CONSTANT_NUMBER: return constant_instruction("OP_ADD_CONSTANT_NUMBER", chunk, offset);
+    case OP_SET_LOCAL_POP: return byte_instruction("OP_SET_LOCAL_POP", chunk, offset);
+    case OP_CONSTANT_CALL: return constant_byte_instruction("OP_CONSTANT_CALL", chunk, offset);
+    case OP_BUILD_LIST:    return byte_instruction("OP_BUILD_LIST", chunk, offset);
+    case OP_INDEX_GET:     return simple_instruction("OP_INDEX_GET", offset);
+    case OP_INDEX_SET:     return simple_instruction("OP_INDEX_SET", offset);
+    case OP_LIST_APPEND:   return simple_instruction("OP_LIST_APPEND", offset);
     case OP_JUMP:          return jump_instruction("OP_JUMP", 1, chunk, offset);
     case OP_LOOP:          return jump_instruction("OP_LOOP", -1, chunk, offset);
     case OP_CLOSURE: {
@@ -101,10 +137,10 @@ int disassemble_instruction(Chunk* chunk, int offset)
 
         ObjectFunction* function = AS_FUNCTION(chunk->constants.values[constant]);
         for (int j = 0; j < function->upvalue_count; j++) {
-            int is_local = chunk->code[offset++];
-            int index    = chunk->code[offset++];
+            int kind  = chunk->code[offset++];
+            int index = chunk->code[offset++];
             printf("%04d      |                     %s %d\n",
-                offset - 2, is_local ? "local" : "upvalue", index);
+                offset - 2, kind == 2 ? "flat" : kind ? "local" : "upvalue", index);
         }
         return offset;
     }
@@ -123,3 +159,99 @@ void disassemble_chunk(Chunk* chunk, const char* name)
         offset = disassemble_instruction(chunk, offset);
     }
 }
+
+#ifdef VM_PROFILE
+// Keyed by OPCode like the dispatch table in run(); used by the profile
+// report only, so the disassembler's per-instruction formats stay put.
+static const char* opcode_names[OP_CODE_COUNT] = {
+    [OP_CALL]          = "OP_CALL",
+    [OP_INVOKE]        = "OP_INVOKE",
+    [OP_SUPER_INVOKE]  = "OP_SUPER_INVOKE",
+    [OP_TAIL_CALL]     = "OP_TAIL_CALL",
+    [OP_TAIL_INVOKE]   = "OP_TAIL_INVOKE",
+    [OP_RETURN]        = "OP_RETURN",
+    [OP_YIELD]         = "OP_YIELD",
+    [OP_POP]           = "OP_POP",
+    [OP_PRINT]         = "OP_PRINT",
+    [OP_LOOP]          = "OP_LOOP",
+    [OP_JUMP]          = "OP_JUMP",
+    [OP_JUMP_IF_FALSE] = "OP_JUMP_IF_FALSE",
+    [OP_INHERIT]       = "OP_INHERIT",
+    [OP_CLASS]         = "OP_CLASS",
+    [OP_METHOD]        = "OP_METHOD",
+    [OP_CLOSURE]       = "OP_CLOSURE",
+    [OP_CONSTANT]      = "OP_CONSTANT",
+    [OP_SET_LOCAL]     = "OP_SET_LOCAL",
+    [OP_SET_GLOBAL]    = "OP_SET_GLOBAL",
+    [OP_SET_UPVALUE]   = "OP_SET_UPVALUE",
+    [OP_SET_PROPERTY]  = "OP_SET_PROPERTY",
+    [OP_GET_LOCAL]     = "OP_GET_LOCAL",
+    [OP_GET_GLOBAL]    = "OP_GET_GLOBAL",
+    [OP_GET_UPVALUE]   = "OP_GET_UPVALUE",
+    [OP_GET_UPVALUE_FLAT] = "OP_GET_UPVALUE_FLAT",
+    [OP_GET_PROPERTY]  = "OP_GET_PROPERTY",
+    [OP_GET_SUPER]     = "OP_GET_SUPER",
+    [OP_CLOSE_UPVALUE] = "OP_CLOSE_UPVALUE",
+    [OP_DEFINE_GLOBAL] = "OP_DEFINE_GLOBAL",
+    [OP_NIL]           = "OP_NIL",
+    [OP_TRUE]          = "OP_TRUE",
+    [OP_FALSE]         = "OP_FALSE",
+    [OP_BUILD_LIST]    = "OP_BUILD_LIST",
+    [OP_INDEX_GET]     = "OP_INDEX_GET",
+    [OP_INDEX_SET]     = "OP_INDEX_SET",
+    [OP_LIST_APPEND]   = "OP_LIST_APPEND",
+    [OP_NOT]           = "OP_NOT",
+    [OP_ADD]           = "OP_ADD",
+    [OP_NEGATE]        = "OP_NEGATE",
+    [OP_SUBTRACT]      = "OP_SUBTRACT",
+    [OP_MULTIPLY]      = "OP_MULTIPLY",
+    [OP_MODULO]        = "OP_MODULO",
+    [OP_DIVIDE]        = "OP_DIVIDE",
+    [OP_EQUAL]         = "OP_EQUAL",
+    [OP_LESS]          = "OP_LESS",
+    [OP_GREATER]       = "OP_GREATER",
+    [OP_GET_LOCAL_GET_LOCAL] = "OP_GET_LOCAL_GET_LOCAL",
+    [OP_ADD_CONSTANT]        = "OP_ADD_CONSTANT",
+    [OP_SET_LOCAL_POP]       = "OP_SET_LOCAL_POP",
+    [OP_CONSTANT_CALL]       = "OP_CONSTANT_CALL",
+    [OP_LESS_JUMP]           = "OP_LESS_JUMP",
+    [OP_GREATER_JUMP]        = "OP_GREATER_JUMP",
+    [OP_EQUAL_JUMP]          = "OP_EQUAL_JUMP",
+    [OP_ADD_NUMBER]          = "OP_ADD_NUMBER",
+    [OP_ADD_CONSTANT_NUMBER] = "OP_ADD_CONSTANT_NUMBER",
+};
+
+static void profile_report_functions(Object* objects)
+{
+    for (Object* object = objects; object != NULL; object = object->next) {
+        if (object->type != OBJECT_FUNCTION) continue;
+
+        ObjectFunction* function = (ObjectFunction*)object;
+        if (function->invocations == 0) continue;
+
+        printf("%-24s %12llu %12.6f\n",
+            function->name != NULL ? function->name->chars : "<script>",
+            (unsigned long long)function->invocations,
+            function->inclusive_time);
+    }
+}
+#endif
+
+void profile_report()
+{
+#ifdef VM_PROFILE
+    printf("== profile: opcodes ==\n");
+    for (int op = 0; op < OP_CODE_COUNT; op++) {
+        if (vm->opcode_counts[op] == 0) continue;
+        printf("%-24s %12llu\n", opcode_names[op],
+            (unsigned long long)vm->opcode_counts[op]);
+    }
+
+    printf("== profile: functions ==\n");
+    printf("%-24s %12s %12s\n", "function", "calls", "incl. time");
+    profile_report_functions(vm->objects);
+    profile_report_functions(vm->old_objects);
+#else
+    printf("profileReport: compile with VM_PROFILE to collect data.\n");
+#endif
+}
@@ -1,26 +1,142 @@
+#ifdef __linux__
+#define _GNU_SOURCE // syscall(); perf_event_open has no libc wrapper
+#endif
+
 #include "common.h"
 #include "chunk.h"
 #include "debug.h"
+#include "compiler.h"
+#include "serializer.h"
 #include "vm.h"
 
+#include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 
-static void repl()
+#ifndef _WIN32
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+// Reads one REPL submission into a growing heap buffer: input of any
+// length is accepted, and lines keep accumulating while a bracket or a
+// string is still open, so pasted multi-line definitions reach the
+// compiler whole. Brackets inside strings and // comments don't count.
+// Returns false once stdin is exhausted.
+static bool read_submission(char** buffer, size_t* capacity)
 {
-    char line[1024];
+    size_t length = 0;
+    int depth = 0;
+    bool in_string  = false;
+    bool in_comment = false;
+    char previous = '\0';
+
+    printf("> ");
     for (;;) {
-        printf("> ");
-        if (!fgets(line, sizeof(line), stdin)) {
-            printf("\n");
+        int c = getchar();
+        if (c == EOF) {
+            if (length == 0)
+                return false;
             break;
         }
 
-        interpret(line);
+        if (length + 2 > *capacity) {
+            *capacity = *capacity < 1024 ? 1024 : *capacity * 2;
+            *buffer = (char*)realloc(*buffer, *capacity);
+            if (*buffer == NULL) {
+                fprintf(stderr, "Not enough memory to read input.\n");
+                exit(74);
+            }
+        }
+        (*buffer)[length++] = (char)c;
+
+        if (c == '\n') {
+            in_comment = false;
+            if (depth <= 0 && !in_string)
+                break;
+            printf(".. ");
+        } else if (in_comment) {
+            // Nothing in a comment affects balance.
+        } else if (c == '"') {
+            in_string = !in_string;
+        } else if (!in_string) {
+            if (c == '/' && previous == '/') {
+                in_comment = true;
+            } else if (c == '(' || c == '{' || c == '[') {
+                depth++;
+            } else if (c == ')' || c == '}' || c == ']') {
+                depth--;
+            }
+        }
+        previous = (char)c;
+    }
+
+    (*buffer)[length] = '\0';
+    return true;
+}
+
+static void repl()
+{
+    char* buffer = NULL;
+    size_t capacity = 0;
+
+    while (read_submission(&buffer, &capacity)) {
+        interpret_repl(buffer);
     }
+
+    printf("\n");
+    free(buffer);
 }
 
+// A loaded script plus how to release it: munmap for a mapping, free for a
+// heap buffer.
+typedef struct {
+    char* source;
+    size_t size;
+    bool mapped;
+} SourceBuffer;
+
+#ifndef _WIN32
+// Maps the file read-only so the OS pages source in on demand and the
+// scanner works straight out of the page cache. The scanner needs a '\0'
+// sentinel; a file whose size is an exact multiple of the page size has no
+// zero byte after it in the mapping, so that (rare) case falls back to the
+// buffered path.
+static bool map_file(const char* path, SourceBuffer* buffer)
+{
+    int fd = open(path, O_RDONLY);
+    if (fd == -1)
+        return false;
+
+    struct stat info;
+    if (fstat(fd, &info) == -1 || info.st_size == 0) {
+        close(fd);
+        return false;
+    }
+
+    size_t size = (size_t)info.st_size;
+    long page_size = sysconf(_SC_PAGESIZE);
+    if (page_size > 0 && size % (size_t)page_size == 0) {
+        close(fd);
+        return false;
+    }
+
+    void* data = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED)
+        return false;
+
+    buffer->source = (char*)data;
+    buffer->size   = size;
+    buffer->mapped = true;
+    return true;
+}
+#endif
+
 static char* read_file(const char* path)
 {
     FILE* file = fopen(path, "rb");
@@ -50,29 +166,241 @@ static char* read_file(const char* path)
     return buffer;
 }
 
+static void load_source(const char* path, SourceBuffer* buffer)
+{
+#ifndef _WIN32
+    if (map_file(path, buffer))
+        return;
+#endif
+
+    buffer->source = read_file(path);
+    buffer->size   = strlen(buffer->source);
+    buffer->mapped = false;
+}
+
+static void release_source(SourceBuffer* buffer)
+{
+#ifndef _WIN32
+    if (buffer->mapped) {
+        munmap(buffer->source, buffer->size);
+        return;
+    }
+#endif
+
+    free(buffer->source);
+}
+
+// --- Benchmark harness -------------------------------------------------
+// clox --bench <script> [reps] runs a workload from bench/ (or any
+// script) in a fresh isolate per repetition, timing only the
+// interpretation so compile cost and VM setup stay out of the numbers,
+// and prints one machine-readable JSON object for CI to diff. On Linux
+// the first measured repetition also captures retired instructions and
+// cache misses through perf_event_open; the fields are omitted when the
+// counters are unavailable (unprivileged containers, other platforms).
+
+#define BENCH_WARMUP_RUNS   2
+#define BENCH_DEFAULT_REPS  10
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+
+static int perf_open(uint32_t type, uint64_t config)
+{
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size           = sizeof(attr);
+    attr.type           = type;
+    attr.config         = config;
+    attr.disabled       = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv     = 1;
+    return (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+static long long perf_read_counter(int fd)
+{
+    long long value = -1;
+    if (fd >= 0 && read(fd, &value, sizeof(value)) != sizeof(value))
+        value = -1;
+    return value;
+}
+#endif
+
+static double bench_now()
+{
+#ifndef _WIN32
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+#else
+    return (double)clock() / CLOCKS_PER_SEC;
+#endif
+}
+
+static int bench_compare(const void* a, const void* b)
+{
+    double x = *(const double*)a;
+    double y = *(const double*)b;
+    return (x > y) - (x < y);
+}
+
+static void bench_file(const char* path, int reps)
+{
+    SourceBuffer buffer;
+    load_source(path, &buffer);
+
+    double* times = (double*)malloc(sizeof(double) * reps);
+    if (times == NULL) {
+        fprintf(stderr, "Not enough memory to run \"%s\".\n", path);
+        exit(74);
+    }
+
+    long long instructions = -1;
+    long long cache_misses = -1;
+
+    VM* previous = vm;
+    for (int run = 0; run < BENCH_WARMUP_RUNS + reps; run++) {
+        VM* isolate = vm_create();
+        if (isolate == NULL) {
+            fprintf(stderr, "Not enough memory to create a VM.\n");
+            exit(74);
+        }
+
+        vm = isolate;
+        ObjectFunction* function = compile(buffer.source);
+        if (function == NULL)
+            exit(65);
+
+        bool measured = run >= BENCH_WARMUP_RUNS;
+#ifdef __linux__
+        int fd_instructions = -1;
+        int fd_cache_misses = -1;
+        if (measured && run == BENCH_WARMUP_RUNS) {
+            fd_instructions = perf_open(PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS);
+            fd_cache_misses = perf_open(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES);
+            if (fd_instructions >= 0) ioctl(fd_instructions, PERF_EVENT_IOC_ENABLE, 0);
+            if (fd_cache_misses >= 0) ioctl(fd_cache_misses, PERF_EVENT_IOC_ENABLE, 0);
+        }
+#endif
+
+        double start = bench_now();
+        InterpretResult result = interpret_function(function);
+        double elapsed = bench_now() - start;
+
+#ifdef __linux__
+        if (fd_instructions >= 0) {
+            ioctl(fd_instructions, PERF_EVENT_IOC_DISABLE, 0);
+            instructions = perf_read_counter(fd_instructions);
+            close(fd_instructions);
+        }
+        if (fd_cache_misses >= 0) {
+            ioctl(fd_cache_misses, PERF_EVENT_IOC_DISABLE, 0);
+            cache_misses = perf_read_counter(fd_cache_misses);
+            close(fd_cache_misses);
+        }
+#endif
+
+        vm = previous;
+        vm_destroy(isolate);
+
+        if (result != INTERPRET_OK)
+            exit(70);
+        if (measured)
+            times[run - BENCH_WARMUP_RUNS] = elapsed;
+    }
+
+    release_source(&buffer);
+
+    qsort(times, reps, sizeof(double), bench_compare);
+    double min    = times[0];
+    double median = reps % 2 == 1 ? times[reps / 2]
+                                  : (times[reps / 2 - 1] + times[reps / 2]) / 2;
+
+    double mean = 0;
+    for (int i = 0; i < reps; i++) mean += times[i];
+    mean /= reps;
+    double variance = 0;
+    for (int i = 0; i < reps; i++) {
+        variance += (times[i] - mean) * (times[i] - mean);
+    }
+    double stddev = reps > 1 ? sqrt(variance / (reps - 1)) : 0;
+
+    printf("{\"benchmark\": \"%s\", \"repetitions\": %d, \"unit\": \"seconds\", "
+           "\"min\": %.6f, \"median\": %.6f, \"mean\": %.6f, \"stddev\": %.6f",
+           path, reps, min, median, mean, stddev);
+    if (instructions >= 0)
+        printf(", \"instructions\": %lld", instructions);
+    if (cache_misses >= 0)
+        printf(", \"cache_misses\": %lld", cache_misses);
+    printf(", \"times\": [");
+    for (int i = 0; i < reps; i++) {
+        printf("%s%.6f", i == 0 ? "" : ", ", times[i]);
+    }
+    printf("]}\n");
+
+    free(times);
+}
+
 static void run_file(const char* path)
 {
-    char* source = read_file(path);
-    InterpretResult result = interpret(source);
-    free(source);
+    SourceBuffer buffer;
+    load_source(path, &buffer);
+    const char* source = buffer.source;
 
-    if (result == INTERPRET_RUNTIME_ERROR) exit(65);
+    size_t length = strlen(path);
+    char* cache_path = (char*)malloc(length + 2);
+    if (cache_path == NULL) {
+        fprintf(stderr, "Not enough memory to run \"%s\".\n", path);
+        exit(74);
+    }
+    memcpy(cache_path, path, length);
+    cache_path[length]     = 'c';
+    cache_path[length + 1] = '\0';
+
+    ObjectFunction* function = loxc_load(cache_path, source);
+    if (function == NULL) {
+        function = compile(source);
+        if (function != NULL) {
+            loxc_save(cache_path, source, function);
+        }
+    }
+
+    free(cache_path);
+    release_source(&buffer);
+
+    if (function == NULL) exit(65);
+
+    InterpretResult result = interpret_function(function);
     if (result == INTERPRET_RUNTIME_ERROR) exit(70);
 }
 
 int main(int argc, char* argv[])
 {
-    init_vm();
+    vm = vm_create();
+    if (vm == NULL) {
+        fprintf(stderr, "Not enough memory to create a VM.\n");
+        exit(74);
+    }
 
     if (argc == 1) {
         repl();
     } else if(argc == 2) {
         run_file(argv[1]);
+    } else if ((argc == 3 || argc == 4) && strcmp(argv[1], "--bench") == 0) {
+        int reps = argc == 4 ? atoi(argv[3]) : BENCH_DEFAULT_REPS;
+        if (reps <= 0) {
+            fprintf(stderr, "Repetition count must be positive.\n");
+            exit(64);
+        }
+        bench_file(argv[2], reps);
     } else {
-        fprintf(stderr, "Usage: clox [path]\n");
+        fprintf(stderr, "Usage: clox [path | --bench path [reps]]\n");
         exit(64);
     }
 
-    free_vm();
+    vm_destroy(vm);
     return 0;
 }
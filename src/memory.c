@@ -9,9 +9,99 @@
 #include "debug.h"
 #endif
 
-#define GC_HEAP_GROW_FACTOR 2
+#include <time.h>
+
+#define GC_MINOR_THRESHOLD (256 * 1024)
+
+#define POOL_GRANULARITY 16
+#define POOL_MAX_SIZE    256
+#define POOL_CLASS_COUNT (POOL_MAX_SIZE / POOL_GRANULARITY)
+#define POOL_SLAB_SIZE   (16 * 1024)
 
 #include <stdlib.h>
+#include <string.h>
+
+// Small blocks are carved from slabs and recycled through per-size-class
+// free lists instead of hitting the system allocator. Every object type
+// lands in one class, so objects freed and reallocated together reuse
+// the same cache-warm cells. reallocate() receives the old size of every
+// block, which makes the pooling invisible to callers.
+
+typedef struct FreeCell {
+    struct FreeCell* next;
+} FreeCell;
+
+typedef struct Slab {
+    struct Slab* next;
+    char pad[POOL_GRANULARITY - sizeof(struct Slab*)];
+} Slab;
+
+// Per-thread, like the VM binding: each isolate's objects live in the pools
+// of the thread that runs it, so isolates never contend on the allocator.
+static CLOX_THREAD_LOCAL FreeCell* free_lists[POOL_CLASS_COUNT];
+static CLOX_THREAD_LOCAL Slab* slabs = NULL;
+
+// Isolates on the same thread share the pools above, so the slabs can
+// only be returned to the system once the last of them is torn down.
+static CLOX_THREAD_LOCAL int pool_users = 0;
+
+void pool_retain()
+{
+    pool_users++;
+}
+
+static int size_class(size_t size)
+{
+    return (int)((size + POOL_GRANULARITY - 1) / POOL_GRANULARITY) - 1;
+}
+
+static void* pool_allocate(size_t size)
+{
+    int klass = size_class(size);
+    FreeCell* cell = free_lists[klass];
+
+    if (cell == NULL) {
+        Slab* slab = (Slab*)malloc(POOL_SLAB_SIZE);
+        if (slab == NULL)
+            exit(-1);
+        slab->next = slabs;
+        slabs = slab;
+
+        size_t cell_size = (size_t)(klass + 1) * POOL_GRANULARITY;
+        char* cursor = (char*)slab + sizeof(Slab);
+        char* end    = (char*)slab + POOL_SLAB_SIZE;
+        while (cursor + cell_size <= end) {
+            FreeCell* carved = (FreeCell*)cursor;
+            carved->next = free_lists[klass];
+            free_lists[klass] = carved;
+            cursor += cell_size;
+        }
+        cell = free_lists[klass];
+    }
+
+    free_lists[klass] = cell->next;
+    return cell;
+}
+
+static void pool_free(void* pointer, size_t size)
+{
+    int klass = size_class(size);
+    FreeCell* cell = (FreeCell*)pointer;
+    cell->next = free_lists[klass];
+    free_lists[klass] = cell;
+}
+
+static void free_pools()
+{
+    Slab* slab = slabs;
+    while (slab != NULL) {
+        Slab* next = slab->next;
+        free(slab);
+        slab = next;
+    }
+    slabs = NULL;
+    memset(free_lists, 0, sizeof(free_lists));
+}
 
 static void free_object(Object* object)
 {
@@ -22,15 +112,31 @@ static void free_object(Object* object)
     switch (object->type) {
     case OBJECT_INSTANCE: {
         ObjectInstance* instance = (ObjectInstance*)object;
-        free_table(&instance->fields);
+        FREE_ARRAY(Value, instance->fields, instance->field_capacity);
         FREE(ObjectInstance, object);
         break;
     }
 
+    case OBJECT_SHAPE: {
+        ObjectShape* shape = (ObjectShape*)object;
+        free_table(&shape->transitions);
+        FREE(ObjectShape, object);
+        break;
+    }
+    case OBJECT_ROPE: {
+        FREE(ObjectRope, object);
+        break;
+    }
+    case OBJECT_LIST: {
+        ObjectList* list = (ObjectList*)object;
+        free_value_array(&list->items);
+        FREE(ObjectList, object);
+        break;
+    }
+
     case OBJECT_STRING: {
         ObjectString* string = (ObjectString*)object;
-        FREE_ARRAY(char, string->chars, string->length + 1);
-        FREE(ObjectString, object);
+        reallocate(object, sizeof(ObjectString) + string->length + 1, 0);
         break;
     }
     case OBJECT_FUNCTION: {
@@ -47,6 +153,7 @@ static void free_object(Object* object)
     case OBJECT_CLOSURE: {
         ObjectClosure* closure = (ObjectClosure*)object;
         FREE_ARRAY(ObjectUpvalue*, closure->upvalues, closure->upvalue_count);
+        FREE_ARRAY(Value, closure->flat, closure->upvalue_count);
         FREE(ObjectClosure, object);
         break;
     }
@@ -54,6 +161,15 @@ static void free_object(Object* object)
         FREE(ObjectUpvalue, object);
         break;
     }
+    case OBJECT_FIBER: {
+        ObjectFiber* fiber = (ObjectFiber*)object;
+        // A finished fiber already released its buffers.
+        FREE_ARRAY(Value, fiber->stack, fiber->stack_capacity);
+        FREE_ARRAY(ObjectUpvalue*, fiber->open_upvalues, fiber->stack_capacity);
+        FREE_ARRAY(CallFrame, fiber->frames, fiber->frame_capacity);
+        FREE(ObjectFiber, object);
+        break;
+    }
     case OBJECT_NATIVE: {
         FREE(ObjectNative, object);
         break;
@@ -64,40 +180,99 @@ static void free_object(Object* object)
         FREE(ObjectClass, object);
         break;
     }
+
+    case OBJECT_TYPE_COUNT:
+        // Sentinel for the gcObjects() counters; no object carries it.
+        break;
     }
 }
 
-void free_objects()
+static void free_object_list(Object* object)
 {
-    Object* object = vm.objects;
     while (object != NULL) {
         Object* next = object->next;
         free_object(object);
         object = next;
     }
+}
 
-    free(vm.gray_stack);
+#ifdef VM_PARALLEL_GC
+static void free_mark_pool();
+#endif
+
+void free_objects()
+{
+    free_object_list(vm->objects);
+    free_object_list(vm->old_objects);
+
+    free(vm->remembered);
+    free(vm->gray_stack);
+#ifdef VM_PARALLEL_GC
+    free_mark_pool();
+#endif
+    // Another isolate on this thread may still hold objects in the
+    // shared slabs; its own teardown frees them.
+    if (--pool_users == 0)
+        free_pools();
 }
 
 void* reallocate(void* pointer, size_t old_size, size_t new_size)
 {
-    vm.bytes_allocated += new_size - old_size;
+    vm->bytes_allocated += new_size - old_size;
 
-    if (new_size > old_size) {
+    if (new_size > old_size && vm->gc_paused == 0) {
 #       ifdef DEBUG_STRESS_GC
-        collect_garbage();
+        collect_garbage_minor();
 #       endif
 
-        if (vm.bytes_allocated > vm.next_gc) {
+        if (vm->bytes_allocated > vm->next_gc) {
             collect_garbage();
+        } else if (vm->bytes_allocated > vm->next_minor_gc) {
+            collect_garbage_minor();
         }
     }
 
+    bool old_pooled = pointer != NULL && old_size > 0 && old_size <= POOL_MAX_SIZE;
+    bool new_pooled = new_size <= POOL_MAX_SIZE;
+
     if (new_size == 0) {
-        free(pointer);
+        if (old_pooled) {
+            pool_free(pointer, old_size);
+        } else {
+            free(pointer);
+        }
         return NULL;
     }
 
+    if (pointer == NULL) {
+        if (new_pooled)
+            return pool_allocate(new_size);
+
+        void* result = malloc(new_size);
+        if (result == NULL) {
+            exit(-1);
+        }
+        return result;
+    }
+
+    // A resize that stays within one size class keeps its cell.
+    if (old_pooled && new_pooled && size_class(old_size) == size_class(new_size))
+        return pointer;
+
+    if (old_pooled || new_pooled) {
+        void* result = new_pooled ? pool_allocate(new_size) : malloc(new_size);
+        if (result == NULL) {
+            exit(-1);
+        }
+        memcpy(result, pointer, old_size < new_size ? old_size : new_size);
+        if (old_pooled) {
+            pool_free(pointer, old_size);
+        } else {
+            free(pointer);
+        }
+        return result;
+    }
+
     void* result = realloc(pointer, new_size);
     if (result == NULL) {
         exit(-1);
@@ -105,30 +280,130 @@ void* reallocate(void* pointer, size_t old_size, size_t new_size)
     return result;
 }
 
+// True while a minor collection is running; the old generation is
+// treated as implicitly live and never traversed.
+static CLOX_THREAD_LOCAL bool gc_minor = false;
+
+#ifdef VM_PARALLEL_GC
+
+#include <pthread.h>
+#include <sched.h>
+
+// Major collections fan tracing out across a small pool of marking
+// threads: the shared gray stack is dealt round-robin into per-worker
+// queues, each worker drains its own and steals half of a victim's when
+// it runs dry, and the is_marked transition in mark_object() becomes an
+// atomic exchange so two workers reaching one object agree on who
+// traces it. While a worker runs, gray_sink routes its mark_object()
+// pushes into its own queue. All of it is per mutator thread, like the
+// allocator pools, so isolates never share marking state. Minor
+// collections keep the serial path: their live sets are small and the
+// gc_minor flag above is deliberately thread-local.
+
+#define GC_MARK_WORKERS 4
+#define GC_PARALLEL_MIN 1024
+#define GC_STEAL_MAX    64
+
+typedef struct {
+    pthread_mutex_t mutex;
+    Object** items;
+    int count;
+    int capacity;
+} GrayDeque;
+
+// Set on each marking thread for the duration of the trace phase; when
+// NULL, mark_object() pushes to the VM's gray stack as always.
+static CLOX_THREAD_LOCAL GrayDeque* gray_sink = NULL;
+
+// Deque buffers grow through realloc, not reallocate(): marking must
+// never re-enter the collector, mirroring the gray stack itself.
+static void deque_push(GrayDeque* deque, Object* object)
+{
+    pthread_mutex_lock(&deque->mutex);
+    if (deque->capacity < deque->count + 1) {
+        deque->capacity = GROW_CAPACITY(deque->capacity);
+        deque->items = (Object**)realloc(deque->items, sizeof(Object*) * deque->capacity);
+        if (deque->items == NULL)
+            exit(1);
+    }
+    deque->items[deque->count++] = object;
+    pthread_mutex_unlock(&deque->mutex);
+}
+
+static bool deque_pop(GrayDeque* deque, Object** object)
+{
+    pthread_mutex_lock(&deque->mutex);
+    bool ok = deque->count > 0;
+    if (ok)
+        *object = deque->items[--deque->count];
+    pthread_mutex_unlock(&deque->mutex);
+    return ok;
+}
+
+// Takes up to half of the victim's queue. The loot is staged in a local
+// buffer so two queue locks are never held at once.
+static bool deque_steal(GrayDeque* victim, GrayDeque* thief)
+{
+    Object* loot[GC_STEAL_MAX];
+
+    pthread_mutex_lock(&victim->mutex);
+    int take = (victim->count + 1) / 2;
+    if (take > GC_STEAL_MAX)
+        take = GC_STEAL_MAX;
+    for (int i = 0; i < take; i++) {
+        loot[i] = victim->items[--victim->count];
+    }
+    pthread_mutex_unlock(&victim->mutex);
+
+    for (int i = 0; i < take; i++) {
+        deque_push(thief, loot[i]);
+    }
+    return take > 0;
+}
+
+#endif
+
 void mark_object(Object* object)
 {
     if (object == NULL)
         return;
 
+    if (gc_minor && object->is_old)
+        return;
+
+#ifdef VM_PARALLEL_GC
+    // Claim the object; when several workers reach it at once exactly
+    // one wins and traces it.
+    if (__atomic_exchange_n(&object->is_marked, true, __ATOMIC_ACQ_REL))
+        return;
+#else
     if (object->is_marked)
         return;
 
+    object->is_marked = true;
+#endif
+
 #ifdef DEBUG_LOG_GC
     printf("%p mark ", (void*)object);
     print_value(OBJECT_VALUE(object));
     printf("\n");
 #endif
 
-    object->is_marked = true;
+#ifdef VM_PARALLEL_GC
+    if (gray_sink != NULL) {
+        deque_push(gray_sink, object);
+        return;
+    }
+#endif
 
-    if (vm.gray_capacity < vm.gray_count + 1) {
-        vm.gray_capacity = GROW_CAPACITY(vm.gray_capacity);
-        vm.gray_stack = (Object**)realloc(vm.gray_stack, sizeof(Object*) * vm.gray_capacity);
+    if (vm->gray_capacity < vm->gray_count + 1) {
+        vm->gray_capacity = GROW_CAPACITY(vm->gray_capacity);
+        vm->gray_stack = (Object**)realloc(vm->gray_stack, sizeof(Object*) * vm->gray_capacity);
     }
 
-    vm.gray_stack[vm.gray_count++] = object;
+    vm->gray_stack[vm->gray_count++] = object;
 
-    if (vm.gray_stack == NULL)
+    if (vm->gray_stack == NULL)
         exit(1);
 }
 
@@ -148,21 +423,33 @@ static void mark_array(ValueArray* array)
 
 static void mark_roots()
 {
-    for (Value* slot = vm.stack; slot < vm.stack_top; slot++) {
-        mark_value(*slot);
-    }
-
-    for (int i = 0; i < vm.frame_count; i++) {
-        mark_object((Object*)vm.frames[i].closure);
-    }
-
-    for (ObjectUpvalue* upvalue = vm.open_upvalues; upvalue != NULL; upvalue = upvalue->next) {
-        mark_object((Object*)upvalue);
+    // Fibers on the resume chain are mutated without write barriers, so
+    // their stacks are traversed as roots every cycle even when the
+    // fiber itself is old; a fiber entering the remembered set when it
+    // yields covers the parked ones.
+    for (ObjectFiber* fiber = vm->fiber; fiber != NULL; fiber = fiber->caller) {
+        mark_object((Object*)fiber);
+        mark_object(fiber->callable);
+        for (Value* slot = fiber->stack; slot < fiber->stack_top; slot++) {
+            mark_value(*slot);
+            ObjectUpvalue* upvalue = fiber->open_upvalues[slot - fiber->stack];
+            if (upvalue != NULL) {
+                mark_object((Object*)upvalue);
+            }
+        }
+        for (int i = 0; i < fiber->frame_count; i++) {
+            mark_object((Object*)fiber->frames[i].closure);
+            mark_object((Object*)fiber->frames[i].function);
+        }
     }
 
-    mark_table(&vm.globals);
+    mark_value(vm->push_guard);
+    mark_table(&vm->global_names);
+    mark_array(&vm->global_slots);
     mark_compiler_roots();
-    mark_object((Object*)vm.init_string);
+    mark_object((Object*)vm->init_string);
+    mark_object((Object*)vm->root_shape);
+    mark_object((Object*)vm->repl_function);
 }
 
 static void blacken_object(Object* object)
@@ -177,7 +464,31 @@ static void blacken_object(Object* object)
     case OBJECT_INSTANCE: {
         ObjectInstance* instance = (ObjectInstance*)object;
         mark_object((Object*)instance->klass);
-        mark_table(&instance->fields);
+        mark_object((Object*)instance->shape);
+        for (int i = 0; i < instance->shape->field_count; i++) {
+            mark_value(instance->fields[i]);
+        }
+        break;
+    }
+
+    case OBJECT_SHAPE: {
+        ObjectShape* shape = (ObjectShape*)object;
+        mark_object((Object*)shape->parent);
+        mark_object((Object*)shape->name);
+        mark_table(&shape->transitions);
+        break;
+    }
+
+    case OBJECT_ROPE: {
+        ObjectRope* rope = (ObjectRope*)object;
+        mark_value(rope->left);
+        mark_value(rope->right);
+        mark_object((Object*)rope->flat);
+        break;
+    }
+
+    case OBJECT_LIST: {
+        mark_array(&((ObjectList*)object)->items);
         break;
     }
 
@@ -186,6 +497,7 @@ static void blacken_object(Object* object)
         mark_object((Object*)closure->function);
         for (int i = 0; i < closure->upvalue_count; i++) {
             mark_object((Object*)closure->upvalues[i]);
+            mark_value(closure->flat[i]);
         }
         break;
     }
@@ -194,6 +506,18 @@ static void blacken_object(Object* object)
         ObjectFunction* function = (ObjectFunction*)object;
         mark_object((Object*)function->name);
         mark_array(&function->chunk.constants);
+
+        // Invoke caches hold bare class/closure pointers; keep them alive
+        // so a cache hit can never reach a recycled object.
+        if (function->chunk.invoke_caches != NULL) {
+            for (int i = 0; i < function->chunk.count; i++) {
+                InvokeCache* cache = &function->chunk.invoke_caches[i];
+                for (int j = 0; j < INVOKE_CACHE_SIZE; j++) {
+                    mark_object((Object*)cache->klass[j]);
+                    mark_object((Object*)cache->method[j]);
+                }
+            }
+        }
         break;
     }
 
@@ -209,6 +533,24 @@ static void blacken_object(Object* object)
         break;
     }
 
+    case OBJECT_FIBER: {
+        ObjectFiber* fiber = (ObjectFiber*)object;
+        mark_object(fiber->callable);
+        mark_object((Object*)fiber->caller);
+        for (Value* slot = fiber->stack; slot < fiber->stack_top; slot++) {
+            mark_value(*slot);
+            ObjectUpvalue* upvalue = fiber->open_upvalues[slot - fiber->stack];
+            if (upvalue != NULL) {
+                mark_object((Object*)upvalue);
+            }
+        }
+        for (int i = 0; i < fiber->frame_count; i++) {
+            mark_object((Object*)fiber->frames[i].closure);
+            mark_object((Object*)fiber->frames[i].function);
+        }
+        break;
+    }
+
     case OBJECT_CLASS: {
         ObjectClass* klass = (ObjectClass*)object;
         mark_object((Object*)klass->name);
@@ -219,21 +561,200 @@ static void blacken_object(Object* object)
     case OBJECT_NATIVE:
     case OBJECT_STRING:
         break;
+
+    case OBJECT_TYPE_COUNT:
+        // Sentinel for the gcObjects() counters; no object carries it.
+        break;
     }
 }
 
 static void trace_references()
 {
-    while (vm.gray_count > 0) {
-        Object* object = vm.gray_stack[--vm.gray_count];
+    while (vm->gray_count > 0) {
+        Object* object = vm->gray_stack[--vm->gray_count];
         blacken_object(object);
     }
 }
 
-static void sweep()
+#ifdef VM_PARALLEL_GC
+
+typedef struct {
+    GrayDeque deques[GC_MARK_WORKERS];
+    int active;
+} MarkPool;
+
+static CLOX_THREAD_LOCAL MarkPool mark_pool;
+static CLOX_THREAD_LOCAL bool mark_pool_ready = false;
+
+typedef struct {
+    MarkPool* pool;
+    int index;
+} MarkWorker;
+
+static void* mark_worker(void* arg)
+{
+    MarkWorker* worker = arg;
+    MarkPool* pool = worker->pool;
+    gray_sink = &pool->deques[worker->index];
+
+    for (;;) {
+        Object* object;
+        while (deque_pop(gray_sink, &object)) {
+            blacken_object(object);
+        }
+
+        // Out of local work. Only active workers can create more, so
+        // once every worker has parked here the trace is complete: work
+        // enters a queue either from its owner while marking or from
+        // its owner's steal, and a thief re-activates before it takes.
+        __atomic_sub_fetch(&pool->active, 1, __ATOMIC_ACQ_REL);
+        for (;;) {
+            int victim = -1;
+            for (int i = 0; i < GC_MARK_WORKERS; i++) {
+                if (i != worker->index &&
+                    __atomic_load_n(&pool->deques[i].count, __ATOMIC_RELAXED) > 0) {
+                    victim = i;
+                    break;
+                }
+            }
+
+            if (victim >= 0) {
+                __atomic_add_fetch(&pool->active, 1, __ATOMIC_ACQ_REL);
+                if (deque_steal(&pool->deques[victim], gray_sink))
+                    break;
+                __atomic_sub_fetch(&pool->active, 1, __ATOMIC_ACQ_REL);
+            } else if (__atomic_load_n(&pool->active, __ATOMIC_ACQUIRE) == 0) {
+                gray_sink = NULL;
+                return NULL;
+            } else {
+                sched_yield();
+            }
+        }
+    }
+}
+
+// Drains the gray stack with GC_MARK_WORKERS threads, the collecting
+// thread included as worker zero. Small heaps stay on the serial path:
+// below GC_PARALLEL_MIN gray objects the spawns cost more than they
+// recover.
+static void trace_references_parallel()
+{
+    if (vm->gray_count < GC_PARALLEL_MIN) {
+        trace_references();
+        return;
+    }
+
+    MarkPool* pool = &mark_pool;
+    if (!mark_pool_ready) {
+        for (int i = 0; i < GC_MARK_WORKERS; i++) {
+            pthread_mutex_init(&pool->deques[i].mutex, NULL);
+        }
+        mark_pool_ready = true;
+    }
+
+    for (int i = 0; i < vm->gray_count; i++) {
+        deque_push(&pool->deques[i % GC_MARK_WORKERS], vm->gray_stack[i]);
+    }
+    vm->gray_count = 0;
+    pool->active = GC_MARK_WORKERS;
+
+    MarkWorker workers[GC_MARK_WORKERS];
+    pthread_t threads[GC_MARK_WORKERS];
+    bool spawned[GC_MARK_WORKERS];
+    for (int i = 1; i < GC_MARK_WORKERS; i++) {
+        workers[i].pool  = pool;
+        workers[i].index = i;
+        spawned[i] = pthread_create(&threads[i], NULL, mark_worker, &workers[i]) == 0;
+        // A failed spawn just leaves its queue to the thieves.
+        if (!spawned[i])
+            __atomic_sub_fetch(&pool->active, 1, __ATOMIC_ACQ_REL);
+    }
+
+    workers[0].pool  = pool;
+    workers[0].index = 0;
+    mark_worker(&workers[0]);
+
+    for (int i = 1; i < GC_MARK_WORKERS; i++) {
+        if (spawned[i])
+            pthread_join(threads[i], NULL);
+    }
+}
+
+static void free_mark_pool()
+{
+    if (!mark_pool_ready)
+        return;
+
+    for (int i = 0; i < GC_MARK_WORKERS; i++) {
+        pthread_mutex_destroy(&mark_pool.deques[i].mutex);
+        free(mark_pool.deques[i].items);
+        mark_pool.deques[i].items    = NULL;
+        mark_pool.deques[i].count    = 0;
+        mark_pool.deques[i].capacity = 0;
+    }
+    mark_pool_ready = false;
+}
+
+#endif
+
+void gc_remember(Object* object)
+{
+    if (object == NULL || !object->is_old || object->is_remembered)
+        return;
+
+    object->is_remembered = true;
+    if (vm->remembered_capacity < vm->remembered_count + 1) {
+        vm->remembered_capacity = GROW_CAPACITY(vm->remembered_capacity);
+        vm->remembered = (Object**)realloc(vm->remembered, sizeof(Object*) * vm->remembered_capacity);
+        if (vm->remembered == NULL)
+            exit(1);
+    }
+
+    vm->remembered[vm->remembered_count++] = object;
+}
+
+void gc_write_barrier(Object* owner, Value value)
+{
+    if (IS_OBJECT(value) && !AS_OBJECT(value)->is_old)
+        gc_remember(owner);
+}
+
+// The remembered set only exists to cover old->young edges; every live
+// young object is promoted below, so no such edge survives a collection.
+static void clear_remembered_set()
+{
+    for (int i = 0; i < vm->remembered_count; i++) {
+        vm->remembered[i]->is_remembered = false;
+    }
+    vm->remembered_count = 0;
+}
+
+// Marked young objects survived a collection; move them to the old
+// generation. Everything reachable from a survivor was marked with it,
+// so the whole live subgraph is promoted together.
+static void sweep_young()
+{
+    Object* object = vm->objects;
+    while (object != NULL) {
+        Object* next = object->next;
+        if (object->is_marked) {
+            object->is_marked = false;
+            object->is_old    = true;
+            object->next      = vm->old_objects;
+            vm->old_objects    = object;
+        } else {
+            free_object(object);
+        }
+        object = next;
+    }
+
+    vm->objects = NULL;
+}
+
+static void sweep_old()
 {
     Object* previous = NULL;
-    Object* object   = vm.objects;
+    Object* object   = vm->old_objects;
     while (object != NULL) {
         if (object->is_marked) {
             object->is_marked = false;
@@ -245,7 +766,7 @@ static void sweep()
             if (previous != NULL) {
                 previous->next = object;
             } else {
-                vm.objects = object;
+                vm->old_objects = object;
             }
 
             free_object(unreached);
@@ -253,23 +774,85 @@ static void sweep()
     }
 }
 
+// Accounts the pause of a finished cycle and notifies the embedder's hook.
+static void record_cycle(bool major, clock_t start)
+{
+    double pause = (double)(clock() - start) / CLOCKS_PER_SEC;
+
+    if (major) vm->gc_major_cycles++;
+    else       vm->gc_minor_cycles++;
+
+    vm->gc_total_pause += pause;
+    if (pause > vm->gc_max_pause)
+        vm->gc_max_pause = pause;
+
+    if (vm->gc_cycle_hook != NULL)
+        vm->gc_cycle_hook(vm, major, pause);
+}
+
 void collect_garbage()
 {
+    clock_t start = clock();
+
 #ifdef DEBUG_LOG_GC
     printf("-- gc begin\n");
-    size_t before = vm.bytes_allocated;
+    size_t before = vm->bytes_allocated;
 
 #endif
 
     mark_roots();
+#ifdef VM_PARALLEL_GC
+    trace_references_parallel();
+#else
     trace_references();
-    table_remove_white(&vm.strings);
-    sweep();
+#endif
+    table_remove_white(&vm->strings, true);
+    clear_remembered_set();
+    sweep_old();
+    sweep_young();
+
+    vm->next_gc       = (size_t)(vm->bytes_allocated * vm->gc_grow_factor);
+    vm->next_minor_gc = vm->bytes_allocated + GC_MINOR_THRESHOLD;
 
-    vm.next_gc = vm.bytes_allocated * GC_HEAP_GROW_FACTOR;
+    record_cycle(true, start);
 
 #ifdef DEBUG_LOG_GC
     printf("-- gc end\n");
-    printf("   collected %zu bytes (from %zu to %zu) next at %zu\n", before - vm.bytes_allocated, before, vm.bytes_allocated, vm.next_gc);
+    printf("   collected %zu bytes (from %zu to %zu) next at %zu\n", before - vm->bytes_allocated, before, vm->bytes_allocated, vm->next_gc);
+#endif
+}
+
+void collect_garbage_minor()
+{
+    clock_t start = clock();
+
+#ifdef DEBUG_LOG_GC
+    printf("-- minor gc begin\n");
+    size_t before = vm->bytes_allocated;
+
+#endif
+
+    gc_minor = true;
+    mark_roots();
+
+    // Objects recorded by the write barrier may hold the only reference
+    // to a young object; treat them as additional roots.
+    for (int i = 0; i < vm->remembered_count; i++) {
+        blacken_object(vm->remembered[i]);
+    }
+
+    trace_references();
+    table_remove_white(&vm->strings, false);
+    clear_remembered_set();
+    sweep_young();
+    gc_minor = false;
+
+    vm->next_minor_gc = vm->bytes_allocated + GC_MINOR_THRESHOLD;
+
+    record_cycle(false, start);
+
+#ifdef DEBUG_LOG_GC
+    printf("-- minor gc end\n");
+    printf("   collected %zu bytes (from %zu to %zu) next at %zu\n", before - vm->bytes_allocated, before, vm->bytes_allocated, vm->next_minor_gc);
 #endif
 }
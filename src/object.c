@@ -4,6 +4,7 @@
 #include "memory.h"
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
 #define ALLOCATE_OBJECT(type, objectType) \
@@ -12,10 +13,12 @@
 static Object* allocate_object(size_t size, ObjectType type)
 {
     Object* object = (Object*)reallocate(NULL, 0, size);
-    object->is_marked = false;
-    object->next      = vm.objects;
-    object->type      = type;
-    vm.objects = object;
+    object->is_marked     = false;
+    object->is_old        = false;
+    object->is_remembered = false;
+    object->next          = vm->objects;
+    object->type          = type;
+    vm->objects = object;
 
 #ifdef DEBUG_LOG_GC
     printf("%p allocate %zu for %d\n", (void*)object, size, type);
@@ -24,15 +27,17 @@ static Object* allocate_object(size_t size, ObjectType type)
     return object;
 }
 
-static ObjectString* allocate_string(char* chars, int length, uint32_t hash)
+static ObjectString* allocate_string(const char* chars, int length, uint32_t hash)
 {
-    ObjectString* string = ALLOCATE_OBJECT(ObjectString, OBJECT_STRING);
+    ObjectString* string =
+        (ObjectString*)allocate_object(sizeof(ObjectString) + length + 1, OBJECT_STRING);
     string->length = length;
-    string->chars = chars;
-    string->hash = hash;
+    string->hash   = hash;
+    memcpy(string->chars, chars, length);
+    string->chars[length] = '\0';
 
     stack_push(OBJECT_VALUE(string));
-    table_set(&vm.strings, string, NIL_VALUE);
+    table_set(&vm->strings, string, NIL_VALUE);
     stack_pop();
 
     return string;
@@ -52,25 +57,20 @@ static uint32_t hash_string(const char* key, int length)
 
 ObjectString* take_string(char* chars, int length)
 {
-    uint32_t hash = hash_string(chars, length);
-    ObjectString* interned = table_find_string(&vm.strings, chars, length, hash);
-    if (interned != NULL) {
-        FREE_ARRAY(char, chars, length + 1);
-        return interned;
-    }
-    return allocate_string(chars, length, hash);
+    // Characters are copied inline now, so the donated buffer is always
+    // released rather than adopted.
+    ObjectString* string = copy_string(chars, length);
+    FREE_ARRAY(char, chars, length + 1);
+    return string;
 }
 
 ObjectString* copy_string(const char* chars, int length)
 {
     uint32_t hash = hash_string(chars, length);
-    ObjectString* interned = table_find_string(&vm.strings, chars, length, hash);
+    ObjectString* interned = table_find_string(&vm->strings, chars, length, hash);
     if (interned != NULL) return interned;
 
-    char* heap_chars = ALLOCATE(char, length + 1);
-    memcpy(heap_chars, chars, length);
-    heap_chars[length] = '\0';
-    return allocate_string(heap_chars, length, hash);
+    return allocate_string(chars, length, hash);
 }
 
 ObjectFunction* new_function()
@@ -79,6 +79,10 @@ ObjectFunction* new_function()
     function->arity = 0;
     function->name = NULL;
     function->upvalue_count = 0;
+    function->heat = 0;
+    function->tiered = false;
+    function->invocations = 0;
+    function->inclusive_time = 0;
     init_chunk(&function->chunk);
     return function;
 }
@@ -87,7 +91,6 @@ ObjectUpvalue* new_upvalue(Value* slot)
 {
     ObjectUpvalue* upvalue = ALLOCATE_OBJECT(ObjectUpvalue, OBJECT_UPVALUE);
     upvalue->location = slot;
-    upvalue->next     = NULL;
     upvalue->closed   = NIL_VALUE;
     return upvalue;
 }
@@ -95,14 +98,17 @@ ObjectUpvalue* new_upvalue(Value* slot)
 ObjectClosure* new_closure(ObjectFunction* function)
 {
     ObjectUpvalue** upvalues = ALLOCATE(ObjectUpvalue*, function->upvalue_count);
+    Value* flat = ALLOCATE(Value, function->upvalue_count);
     for (int i = 0; i < function->upvalue_count; i++) {
         upvalues[i] = NULL;
+        flat[i]     = NIL_VALUE;
     }
 
     ObjectClosure* closure = ALLOCATE_OBJECT(ObjectClosure, OBJECT_CLOSURE);
     closure->upvalue_count = function->upvalue_count;
     closure->function      = function;
     closure->upvalues      = upvalues;
+    closure->flat          = flat;
     return closure;
 }
 
@@ -117,12 +123,151 @@ ObjectClass* new_class(ObjectString* name)
 ObjectInstance* new_instance(ObjectClass* klass)
 {
     ObjectInstance* instance = ALLOCATE_OBJECT(ObjectInstance, OBJECT_INSTANCE);
-    instance->klass = klass;
-    init_table(&instance->fields);
+    instance->klass          = klass;
+    instance->shape          = vm->root_shape;
+    instance->field_capacity = 0;
+    instance->fields         = NULL;
     return instance;
 }
 
-ObjectBoundMethod* new_bound_method(Value reciever, ObjectClosure* method)
+ObjectShape* new_shape(ObjectShape* parent, ObjectString* name)
+{
+    ObjectShape* shape = ALLOCATE_OBJECT(ObjectShape, OBJECT_SHAPE);
+    shape->parent      = parent;
+    shape->name        = name;
+    shape->slot        = parent != NULL ? parent->field_count : -1;
+    shape->field_count = parent != NULL ? parent->field_count + 1 : 0;
+    init_table(&shape->transitions);
+    return shape;
+}
+
+int shape_slot(ObjectShape* shape, ObjectString* name)
+{
+    for (; shape->parent != NULL; shape = shape->parent) {
+        if (shape->name == name)
+            return shape->slot;
+    }
+    return -1;
+}
+
+ObjectShape* shape_add(ObjectShape* shape, ObjectString* name)
+{
+    Value next;
+    if (table_get(&shape->transitions, name, &next)) {
+        return AS_SHAPE(next);
+    }
+
+    ObjectShape* created = new_shape(shape, name);
+    stack_push(OBJECT_VALUE(created));
+    table_set(&shape->transitions, name, OBJECT_VALUE(created));
+    gc_write_barrier((Object*)shape, OBJECT_VALUE(name));
+    gc_write_barrier((Object*)shape, OBJECT_VALUE(created));
+    stack_pop();
+    return created;
+}
+
+ObjectList* new_list()
+{
+    ObjectList* list = ALLOCATE_OBJECT(ObjectList, OBJECT_LIST);
+    init_value_array(&list->items);
+    return list;
+}
+
+#define FIBER_STACK_INITIAL  64
+#define FIBER_FRAMES_INITIAL 4
+
+ObjectFiber* new_fiber(Object* callable)
+{
+    // Buffers first, like new_closure(): the fiber object is unreachable
+    // until it is returned, so nothing may allocate after it exists.
+    Value* stack = ALLOCATE(Value, FIBER_STACK_INITIAL);
+    CallFrame* frames = ALLOCATE(CallFrame, FIBER_FRAMES_INITIAL);
+    ObjectUpvalue** open_upvalues = ALLOCATE(ObjectUpvalue*, FIBER_STACK_INITIAL);
+    for (int i = 0; i < FIBER_STACK_INITIAL; i++) {
+        open_upvalues[i] = NULL;
+    }
+
+    ObjectFiber* fiber = ALLOCATE_OBJECT(ObjectFiber, OBJECT_FIBER);
+    fiber->state          = FIBER_NEW;
+    fiber->callable       = callable;
+    fiber->caller         = NULL;
+    fiber->stack          = stack;
+    fiber->stack_top      = stack;
+    fiber->stack_capacity = FIBER_STACK_INITIAL;
+    fiber->frames         = frames;
+    fiber->frame_count    = 0;
+    fiber->frame_capacity = FIBER_FRAMES_INITIAL;
+    fiber->open_upvalues  = open_upvalues;
+    return fiber;
+}
+
+ObjectRope* new_rope(Value left, Value right)
+{
+    ObjectRope* rope = ALLOCATE_OBJECT(ObjectRope, OBJECT_ROPE);
+    rope->length = string_like_length(left) + string_like_length(right);
+    rope->left   = left;
+    rope->right  = right;
+    rope->flat   = NULL;
+    return rope;
+}
+
+int string_like_length(Value value)
+{
+    return IS_STRING(value) ? AS_STRING(value)->length : AS_ROPE(value)->length;
+}
+
+ObjectString* flatten_string(Value value)
+{
+    if (IS_STRING(value))
+        return AS_STRING(value);
+
+    ObjectRope* rope = AS_ROPE(value);
+    if (rope->flat != NULL)
+        return rope->flat;
+
+    stack_push(value);
+    char* buffer = ALLOCATE(char, rope->length + 1);
+
+    // Walk the tree with an explicit worklist: loop-built ropes lean left
+    // far too deeply for recursion. Nothing in the walk allocates, so the
+    // rope only needs the one root above.
+    int capacity = 8;
+    int count    = 0;
+    Value* work  = (Value*)malloc(sizeof(Value) * capacity);
+    if (work == NULL)
+        exit(-1);
+
+    int position = 0;
+    work[count++] = value;
+    while (count > 0) {
+        Value node = work[--count];
+        if (IS_STRING(node) || AS_ROPE(node)->flat != NULL) {
+            ObjectString* string = IS_STRING(node) ? AS_STRING(node) : AS_ROPE(node)->flat;
+            memcpy(buffer + position, string->chars, string->length);
+            position += string->length;
+            continue;
+        }
+
+        if (count + 2 > capacity) {
+            capacity *= 2;
+            work = (Value*)realloc(work, sizeof(Value) * capacity);
+            if (work == NULL)
+                exit(-1);
+        }
+        work[count++] = AS_ROPE(node)->right;
+        work[count++] = AS_ROPE(node)->left;
+    }
+    free(work);
+
+    buffer[rope->length] = '\0';
+    ObjectString* flat = take_string(buffer, rope->length);
+    rope->flat = flat;
+    gc_write_barrier((Object*)rope, OBJECT_VALUE(flat));
+    stack_pop();
+    return flat;
+}
+
+ObjectBoundMethod* new_bound_method(Value reciever, Object* method)
 {
     ObjectBoundMethod* bound_method = ALLOCATE_OBJECT(ObjectBoundMethod, OBJECT_BOUND_METHOD);
     bound_method->reciever = reciever;
@@ -130,13 +275,59 @@ ObjectBoundMethod* new_bound_method(Value reciever, ObjectClosure* method)
     return bound_method;
 }
 
-ObjectNative* new_native(NativeFn function)
+ObjectNative* new_native(NativeFn function, const char* name, int arity, const char* params)
 {
     ObjectNative* native = ALLOCATE_OBJECT(ObjectNative, OBJECT_NATIVE);
     native->function = function;
+    native->name     = name;
+    native->arity    = arity;
+    native->params   = params;
     return native;
 }
 
+// Print a rope piecewise without flattening: this also runs from GC
+// debug logging, where allocating (and so re-entering the collector)
+// is not an option.
+static void print_rope(ObjectRope* rope)
+{
+    if (rope->flat != NULL) {
+        printf("%s", rope->flat->chars);
+        return;
+    }
+
+    int capacity = 8;
+    int count    = 0;
+    Value* work  = (Value*)malloc(sizeof(Value) * capacity);
+    if (work == NULL)
+        exit(-1);
+
+    work[count++] = rope->right;
+    work[count++] = rope->left;
+    while (count > 0) {
+        Value node = work[--count];
+        if (IS_STRING(node)) {
+            printf("%s", AS_STRING(node)->chars);
+            continue;
+        }
+
+        ObjectRope* inner = AS_ROPE(node);
+        if (inner->flat != NULL) {
+            printf("%s", inner->flat->chars);
+            continue;
+        }
+
+        if (count + 2 > capacity) {
+            capacity *= 2;
+            work = (Value*)realloc(work, sizeof(Value) * capacity);
+            if (work == NULL)
+                exit(-1);
+        }
+        work[count++] = inner->right;
+        work[count++] = inner->left;
+    }
+    free(work);
+}
+
 static void print_function(ObjectFunction* function)
 {
     if (function->name == NULL) {
@@ -159,7 +350,7 @@ void print_object(Value value)
         break;
     }
     case OBJECT_BOUND_METHOD: {
-        print_function(AS_BOUND_METHOD(value)->method->function);
+        print_function(callable_function(AS_BOUND_METHOD(value)->method));
         break;
     }
     case OBJECT_CLOSURE: {
@@ -174,6 +365,19 @@ void print_object(Value value)
         printf("upvalue");
         break;
     }
+    case OBJECT_LIST: {
+        ObjectList* list = AS_LIST(value);
+        printf("[");
+        for (int i = 0; i < list->items.count; i++) {
+            if (i > 0) printf(", ");
+            print_value(list->items.values[i]);
+        }
+        printf("]");
+        break;
+    }
+    case OBJECT_SHAPE: printf("<shape>"); break;
+    case OBJECT_FIBER: printf("<fiber>"); break;
+    case OBJECT_ROPE: print_rope(AS_ROPE(value)); break;
     case OBJECT_NATIVE: printf("<native fn>"); break;
     case OBJECT_STRING: printf("%s", AS_CSTRING(value)); break;
     default: printf("UNKNOWN_OBJECT"); break;
@@ -0,0 +1,245 @@
+#include "object.h"
+#include "memory.h"
+#include "optimizer.h"
+
+#include <string.h>
+
+// Peephole pass over a finished chunk. Adjacent instruction pairs that show
+// up constantly in real traces are fused into single superinstructions so
+// the VM pays one dispatch instead of two. Fusing shrinks the code stream,
+// so every jump operand is remapped through an old-offset -> new-offset
+// table, and a pair is never fused when a jump lands on its second half.
+
+int instruction_length(Chunk* chunk, int offset)
+{
+    switch (chunk->code[offset]) {
+    case OP_CALL:
+    case OP_TAIL_CALL:
+    case OP_CLASS:
+    case OP_METHOD:
+    case OP_CONSTANT:
+    case OP_SET_LOCAL:
+    case OP_SET_GLOBAL:
+    case OP_SET_UPVALUE:
+    case OP_SET_PROPERTY:
+    case OP_GET_LOCAL:
+    case OP_GET_GLOBAL:
+    case OP_GET_UPVALUE:
+    case OP_GET_UPVALUE_FLAT:
+    case OP_GET_PROPERTY:
+    case OP_GET_SUPER:
+    case OP_DEFINE_GLOBAL:
+    case OP_ADD_CONSTANT:
+    case OP_ADD_CONSTANT_NUMBER:
+    case OP_SET_LOCAL_POP:
+    case OP_BUILD_LIST:
+        return 2;
+
+    case OP_LOOP:
+    case OP_JUMP:
+    case OP_JUMP_IF_FALSE:
+    case OP_LESS_JUMP:
+    case OP_GREATER_JUMP:
+    case OP_EQUAL_JUMP:
+    case OP_INVOKE:
+    case OP_SUPER_INVOKE:
+    case OP_TAIL_INVOKE:
+    case OP_GET_LOCAL_GET_LOCAL:
+    case OP_CONSTANT_CALL:
+        return 3;
+
+    case OP_CLOSURE: {
+        ObjectFunction* function = AS_FUNCTION(chunk->constants.values[chunk->code[offset + 1]]);
+        return 2 + function->upvalue_count * 2;
+    }
+
+    default:
+        return 1;
+    }
+}
+
+static bool is_jump(uint8_t op)
+{
+    return op == OP_JUMP || op == OP_JUMP_IF_FALSE || op == OP_LOOP ||
+           op == OP_LESS_JUMP || op == OP_GREATER_JUMP || op == OP_EQUAL_JUMP;
+}
+
+static uint8_t fused_compare_jump(uint8_t op)
+{
+    switch (op) {
+    case OP_LESS:    return OP_LESS_JUMP;
+    case OP_GREATER: return OP_GREATER_JUMP;
+    case OP_EQUAL:   return OP_EQUAL_JUMP;
+    default:         return 0xff;
+    }
+}
+
+static int jump_target(Chunk* chunk, int offset)
+{
+    int operand = (chunk->code[offset + 1] << 8) | chunk->code[offset + 2];
+    return chunk->code[offset] == OP_LOOP ? offset + 3 - operand : offset + 3 + operand;
+}
+
+void optimize_chunk(Chunk* chunk)
+{
+    int count = chunk->count;
+    if (count == 0)
+        return;
+
+    // Jump landing pads must survive the rewrite as instruction starts.
+    bool* is_target = ALLOCATE(bool, count + 1);
+    memset(is_target, 0, sizeof(bool) * (count + 1));
+
+    for (int offset = 0; offset < count; offset += instruction_length(chunk, offset)) {
+        if (is_jump(chunk->code[offset])) {
+            is_target[jump_target(chunk, offset)] = true;
+        }
+    }
+
+    uint8_t* code = ALLOCATE(uint8_t, count);
+    int* lines    = ALLOCATE(int, count);
+    int* map      = ALLOCATE(int, count + 1);
+
+    // Jumps are copied with their old operands and patched afterwards,
+    // once the offsets of their targets in the new stream are known.
+    int jump_count   = 0;
+    int* jump_froms  = ALLOCATE(int, count);
+    int* jump_olds   = ALLOCATE(int, count);
+
+    int out = 0;
+    int offset = 0;
+    while (offset < count) {
+        map[offset] = out;
+
+        uint8_t op = chunk->code[offset];
+        int length = instruction_length(chunk, offset);
+        int next   = offset + length;
+        int line   = chunk->lines[offset];
+
+        uint8_t next_op = (next < count && !is_target[next]) ? chunk->code[next] : 0xff;
+
+        // Compare + OP_JUMP_IF_FALSE + fall-through OP_POP, where the jump
+        // also lands on an OP_POP of the condition: all four collapse into
+        // one compare-and-branch that pops its operands itself. The taken
+        // path is retargeted one byte past its landing pop. This is the
+        // loop-condition shape, so it dominates instruction mixes.
+        if (fused_compare_jump(op) != 0xff && next_op == OP_JUMP_IF_FALSE &&
+            next + 3 < count && !is_target[next + 3] &&
+            chunk->code[next + 3] == OP_POP) {
+            int target = jump_target(chunk, next);
+            if (target <= count - 1 && chunk->code[target] == OP_POP) {
+                code[out] = fused_compare_jump(op);
+                lines[out] = lines[out + 1] = lines[out + 2] = line;
+
+                jump_froms[jump_count] = out;
+                jump_olds[jump_count]  = target + 1;
+                jump_count++;
+
+                out += 3;
+                offset = next + 4;
+                continue;
+            }
+        }
+
+        if (op == OP_GET_LOCAL && next_op == OP_GET_LOCAL) {
+            code[out] = OP_GET_LOCAL_GET_LOCAL;
+            code[out + 1] = chunk->code[offset + 1];
+            code[out + 2] = chunk->code[next + 1];
+            lines[out] = lines[out + 1] = lines[out + 2] = line;
+            out += 3;
+            offset = next + 2;
+            continue;
+        }
+
+        if (op == OP_CONSTANT && next_op == OP_ADD) {
+            code[out] = OP_ADD_CONSTANT;
+            code[out + 1] = chunk->code[offset + 1];
+            lines[out] = lines[out + 1] = line;
+            out += 2;
+            offset = next + 1;
+            continue;
+        }
+
+        if (op == OP_SET_LOCAL && next_op == OP_POP) {
+            code[out] = OP_SET_LOCAL_POP;
+            code[out + 1] = chunk->code[offset + 1];
+            lines[out] = lines[out + 1] = line;
+            out += 2;
+            offset = next + 1;
+            continue;
+        }
+
+        if (op == OP_CONSTANT && next_op == OP_CALL) {
+            code[out] = OP_CONSTANT_CALL;
+            code[out + 1] = chunk->code[offset + 1];
+            code[out + 2] = chunk->code[next + 1];
+            lines[out] = lines[out + 1] = lines[out + 2] = line;
+            out += 3;
+            offset = next + 2;
+            continue;
+        }
+
+        if (is_jump(op)) {
+            jump_froms[jump_count] = out;
+            jump_olds[jump_count]  = jump_target(chunk, offset);
+            jump_count++;
+        }
+
+        for (int i = 0; i < length; i++) {
+            code[out + i]  = chunk->code[offset + i];
+            lines[out + i] = chunk->lines[offset + i];
+        }
+        out += length;
+        offset = next;
+    }
+    map[count] = out;
+
+    for (int i = 0; i < jump_count; i++) {
+        int from   = jump_froms[i];
+        int target = map[jump_olds[i]];
+        int jump   = code[from] == OP_LOOP ? (from + 3) - target : target - (from + 3);
+        code[from + 1] = (jump >> 8) & 0xff;
+        code[from + 2] = jump & 0xff;
+    }
+
+    FREE_ARRAY(int, jump_olds, count);
+    FREE_ARRAY(int, jump_froms, count);
+    FREE_ARRAY(int, map, count + 1);
+    FREE_ARRAY(bool, is_target, count + 1);
+
+    FREE_ARRAY(uint8_t, chunk->code, chunk->capacity);
+    FREE_ARRAY(int, chunk->lines, chunk->capacity);
+    chunk->code     = code;
+    chunk->lines    = lines;
+    chunk->count    = out;
+    chunk->capacity = count;
+}
+
+// Second tier, driven at runtime by ObjectFunction.heat: once a function
+// has run hot enough, its arithmetic sites are rewritten in place to
+// speculative numeric forms that skip the string checks the generic
+// handlers pay on every execution. A site whose speculation fails
+// rewrites itself back, so the pass installs the fast forms blindly.
+// Rewriting in place keeps every live frame's ip valid, including
+// recursive activations and parked fibers; it also means a chunk loaded
+// from a .loxc cache stays at the first tier, since its code lives in a
+// read-only file mapping.
+void quicken_chunk(Chunk* chunk)
+{
+    if (chunk->mapped)
+        return;
+
+    for (int offset = 0; offset < chunk->count;
+         offset += instruction_length(chunk, offset)) {
+        switch (chunk->code[offset]) {
+        case OP_ADD:
+            chunk->code[offset] = OP_ADD_NUMBER;
+            break;
+        case OP_ADD_CONSTANT:
+            chunk->code[offset] = OP_ADD_CONSTANT_NUMBER;
+            break;
+        default:
+            break;
+        }
+    }
+}
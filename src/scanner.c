@@ -10,7 +10,7 @@ typedef struct {
     int line;
 } Scanner;
 
-static Scanner scanner;
+static CLOX_THREAD_LOCAL Scanner scanner;
 
 static bool is_at_end()
 {
@@ -156,6 +156,7 @@ static TokenType identifier_type()
     case 's': return check_keyword(1, 4, "uper", TOKEN_SUPER);
     case 'v': return check_keyword(1, 2, "ar", TOKEN_VAR);
     case 'w': return check_keyword(1, 4, "hile", TOKEN_WHILE);
+    case 'y': return check_keyword(1, 4, "ield", TOKEN_YIELD);
     case 'f':
         if (scanner.current - scanner.start > 1) {
             switch (scanner.start[1]) {
@@ -200,6 +201,8 @@ Token scan_token()
     case '(': return make_token(TOKEN_LEFT_PAREN);
     case ')': return make_token(TOKEN_RIGHT_PAREN);
     case '{': return make_token(TOKEN_LEFT_BRACE);
+    case '[': return make_token(TOKEN_LEFT_BRACKET);
+    case ']': return make_token(TOKEN_RIGHT_BRACKET);
     case '}': return make_token(TOKEN_RIGHT_BRACE);
     case ';': return make_token(TOKEN_SEMICOLON);
     case ',': return make_token(TOKEN_COMMA);
@@ -0,0 +1,384 @@
+#include "serializer.h"
+#include "memory.h"
+#include "vm.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+// File layout (native endianness, every field padded to 8 bytes):
+//
+//   magic, version, source hash
+//   global name table        slot order must replay identically
+//   function record          recursing into function constants
+//
+// Code and line arrays are used straight out of the mapping (the chunk
+// is flagged as mapped so free_chunk() leaves them alone); only
+// constants are materialized as heap objects. The mapping itself stays
+// alive for the rest of the process.
+
+#define LOXC_MAGIC   0x43584f4c
+#define LOXC_VERSION 4
+
+#define TAG_CONST_NUMBER   0
+#define TAG_CONST_STRING   1
+#define TAG_CONST_FUNCTION 2
+
+static uint64_t hash_source(const char* source)
+{
+    uint64_t hash = 14695981039346656037u;
+    for (const char* c = source; *c != '\0'; c++) {
+        hash ^= (uint8_t)*c;
+        hash *= 1099511628211u;
+    }
+    return hash;
+}
+
+typedef struct {
+    FILE* file;
+    size_t offset;
+    bool ok;
+} Writer;
+
+static void write_bytes(Writer* writer, const void* data, size_t size)
+{
+    if (!writer->ok)
+        return;
+
+    if (fwrite(data, 1, size, writer->file) != size) {
+        writer->ok = false;
+        return;
+    }
+    writer->offset += size;
+}
+
+static void write_pad(Writer* writer)
+{
+    static const uint8_t zeros[8] = { 0 };
+    size_t rest = writer->offset % 8;
+    if (rest != 0) {
+        write_bytes(writer, zeros, 8 - rest);
+    }
+}
+
+static void write_u32(Writer* writer, uint32_t value)
+{
+    write_bytes(writer, &value, sizeof(value));
+    write_pad(writer);
+}
+
+static void write_u64(Writer* writer, uint64_t value)
+{
+    write_bytes(writer, &value, sizeof(value));
+}
+
+static void write_string(Writer* writer, ObjectString* string)
+{
+    write_u32(writer, (uint32_t)string->length);
+    write_bytes(writer, string->chars, string->length);
+    write_pad(writer);
+}
+
+static void write_function(Writer* writer, ObjectFunction* function)
+{
+    write_u32(writer, (uint32_t)function->arity);
+    write_u32(writer, (uint32_t)function->upvalue_count);
+
+    if (function->name != NULL) {
+        write_u32(writer, 1);
+        write_string(writer, function->name);
+    } else {
+        write_u32(writer, 0);
+    }
+
+    Chunk* chunk = &function->chunk;
+    write_u32(writer, (uint32_t)chunk->count);
+    write_bytes(writer, chunk->code, chunk->count);
+    write_pad(writer);
+    write_bytes(writer, chunk->lines, sizeof(int) * chunk->count);
+    write_pad(writer);
+
+    write_u32(writer, (uint32_t)chunk->constants.count);
+    for (int i = 0; i < chunk->constants.count; i++) {
+        Value constant = chunk->constants.values[i];
+        if (IS_NUMBER(constant)) {
+            write_u32(writer, TAG_CONST_NUMBER);
+            double number = AS_NUMBER(constant);
+            write_bytes(writer, &number, sizeof(number));
+        } else if (IS_STRING(constant)) {
+            write_u32(writer, TAG_CONST_STRING);
+            write_string(writer, AS_STRING(constant));
+        } else if (IS_FUNCTION(constant)) {
+            write_u32(writer, TAG_CONST_FUNCTION);
+            write_function(writer, AS_FUNCTION(constant));
+        } else {
+            writer->ok = false;
+            return;
+        }
+    }
+}
+
+void loxc_save(const char* path, const char* source, ObjectFunction* function)
+{
+    FILE* file = fopen(path, "wb");
+    if (file == NULL)
+        return;
+
+    Writer writer;
+    writer.file   = file;
+    writer.offset = 0;
+    writer.ok     = true;
+
+    write_u32(&writer, LOXC_MAGIC);
+    write_u32(&writer, LOXC_VERSION);
+    write_u64(&writer, hash_source(source));
+
+    write_u32(&writer, (uint32_t)vm->global_slots.count);
+    for (int i = 0; i < vm->global_slots.count; i++) {
+        write_string(&writer, global_name(i));
+    }
+
+    write_function(&writer, function);
+
+    fclose(file);
+    if (!writer.ok) {
+        remove(path);
+    }
+}
+
+typedef struct {
+    const uint8_t* data;
+    size_t size;
+    size_t offset;
+    bool ok;
+} Reader;
+
+static const void* read_bytes(Reader* reader, size_t size)
+{
+    if (!reader->ok || reader->size - reader->offset < size) {
+        reader->ok = false;
+        return NULL;
+    }
+
+    const void* result = reader->data + reader->offset;
+    reader->offset += size;
+    return result;
+}
+
+static void read_pad(Reader* reader)
+{
+    size_t rest = reader->offset % 8;
+    if (rest != 0) {
+        read_bytes(reader, 8 - rest);
+    }
+}
+
+static uint32_t read_u32(Reader* reader)
+{
+    const void* bytes = read_bytes(reader, sizeof(uint32_t));
+    read_pad(reader);
+    if (bytes == NULL)
+        return 0;
+
+    uint32_t value;
+    memcpy(&value, bytes, sizeof(value));
+    return value;
+}
+
+static uint64_t read_u64(Reader* reader)
+{
+    const void* bytes = read_bytes(reader, sizeof(uint64_t));
+    if (bytes == NULL)
+        return 0;
+
+    uint64_t value;
+    memcpy(&value, bytes, sizeof(value));
+    return value;
+}
+
+static ObjectString* read_string(Reader* reader)
+{
+    uint32_t length = read_u32(reader);
+    if (length > INT32_MAX)
+        reader->ok = false;
+
+    const char* chars = (const char*)read_bytes(reader, length);
+    read_pad(reader);
+    if (chars == NULL)
+        return NULL;
+
+    return copy_string(chars, (int)length);
+}
+
+static ObjectFunction* read_function(Reader* reader)
+{
+    ObjectFunction* function = new_function();
+    stack_push(OBJECT_VALUE(function));
+
+    function->arity         = (int)read_u32(reader);
+    function->upvalue_count = (int)read_u32(reader);
+
+    if (read_u32(reader) != 0) {
+        function->name = read_string(reader);
+        gc_write_barrier((Object*)function, OBJECT_VALUE(function->name));
+    }
+
+    Chunk* chunk = &function->chunk;
+    uint32_t count = read_u32(reader);
+    if (count > INT32_MAX)
+        reader->ok = false;
+
+    const uint8_t* code = (const uint8_t*)read_bytes(reader, count);
+    read_pad(reader);
+    const int* lines = (const int*)read_bytes(reader, sizeof(int) * count);
+    read_pad(reader);
+
+    if (reader->ok) {
+        chunk->code     = (uint8_t*)code;
+        chunk->lines    = (int*)lines;
+        chunk->count    = (int)count;
+        chunk->capacity = (int)count;
+        chunk->mapped   = true;
+    }
+
+    uint32_t constant_count = read_u32(reader);
+    for (uint32_t i = 0; reader->ok && i < constant_count; i++) {
+        Value constant;
+        switch (read_u32(reader)) {
+        case TAG_CONST_NUMBER: {
+            const void* bytes = read_bytes(reader, sizeof(double));
+            if (bytes == NULL) {
+                stack_pop();
+                return NULL;
+            }
+            double number;
+            memcpy(&number, bytes, sizeof(number));
+            constant = NUMBER_VALUE(number);
+            break;
+        }
+        case TAG_CONST_STRING: {
+            ObjectString* string = read_string(reader);
+            if (string == NULL) {
+                stack_pop();
+                return NULL;
+            }
+            constant = OBJECT_VALUE(string);
+            break;
+        }
+        case TAG_CONST_FUNCTION: {
+            ObjectFunction* nested = read_function(reader);
+            if (nested == NULL) {
+                stack_pop();
+                return NULL;
+            }
+            constant = OBJECT_VALUE(nested);
+            break;
+        }
+        default:
+            stack_pop();
+            return NULL;
+        }
+
+        stack_push(constant);
+        write_value_array(&chunk->constants, constant);
+        stack_pop();
+        gc_write_barrier((Object*)function, constant);
+    }
+
+    stack_pop();
+    return reader->ok ? function : NULL;
+}
+
+static const uint8_t* map_file(const char* path, size_t* size)
+{
+#ifdef _WIN32
+    FILE* file = fopen(path, "rb");
+    if (file == NULL)
+        return NULL;
+
+    fseek(file, 0L, SEEK_END);
+    long file_size = ftell(file);
+    rewind(file);
+    if (file_size <= 0) {
+        fclose(file);
+        return NULL;
+    }
+
+    uint8_t* buffer = (uint8_t*)malloc(file_size);
+    if (buffer == NULL || fread(buffer, 1, file_size, file) != (size_t)file_size) {
+        free(buffer);
+        fclose(file);
+        return NULL;
+    }
+
+    fclose(file);
+    *size = (size_t)file_size;
+    return buffer;
+#else
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return NULL;
+
+    struct stat status;
+    if (fstat(fd, &status) < 0 || status.st_size == 0) {
+        close(fd);
+        return NULL;
+    }
+
+    void* mapping = mmap(NULL, status.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mapping == MAP_FAILED)
+        return NULL;
+
+    *size = (size_t)status.st_size;
+    return (const uint8_t*)mapping;
+#endif
+}
+
+ObjectFunction* loxc_load(const char* path, const char* source)
+{
+    size_t size;
+    const uint8_t* data = map_file(path, &size);
+    if (data == NULL)
+        return NULL;
+
+    Reader reader;
+    reader.data   = data;
+    reader.size   = size;
+    reader.offset = 0;
+    reader.ok     = true;
+
+    if (read_u32(&reader) != LOXC_MAGIC ||
+        read_u32(&reader) != LOXC_VERSION ||
+        read_u64(&reader) != hash_source(source)) {
+        reader.ok = false;
+    }
+
+    // Global accesses are compiled to slot indices; replaying the name
+    // table must reproduce them exactly or the cache is unusable.
+    uint32_t global_count = reader.ok ? read_u32(&reader) : 0;
+    for (uint32_t i = 0; reader.ok && i < global_count; i++) {
+        ObjectString* name = read_string(&reader);
+        if (name == NULL || vm_global_slot(name) != (int)i) {
+            reader.ok = false;
+        }
+    }
+
+    ObjectFunction* function = reader.ok ? read_function(&reader) : NULL;
+    if (function == NULL) {
+#ifndef _WIN32
+        munmap((void*)data, size);
+#endif
+        return NULL;
+    }
+
+    return function;
+}
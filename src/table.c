@@ -5,54 +5,122 @@
 
 #include <string.h>
 
+#if !defined(TABLE_NO_SSE2) && (defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2))
+#   define TABLE_USE_SSE2
+#   include <emmintrin.h>
+#endif
+
+#if defined(_MSC_VER)
+#   include <intrin.h>
+#endif
+
 #define TABLE_MAX_LOAD 0.75
 
-static Entry* find_entry(Entry* entries, int capacity, ObjectString* key)
+// Capacities are powers of two so every probe step is a mask instead of a
+// division, and the metadata array is scanned a whole group at a time.
+#define TABLE_MIN_CAPACITY 16
+#define TABLE_GROUP_SIZE 16
+
+// One metadata byte per slot: empty and deleted states have the high bit set,
+// full slots store the top seven bits of the key's hash. A probe can then
+// reject almost every non-matching slot without ever loading its Entry.
+#define META_EMPTY   0x80
+#define META_DELETED 0xFE
+
+static inline uint8_t hash_fragment(uint32_t hash)
 {
-    uint32_t index = key->hash % capacity;
-    Entry* tombstone = NULL;
-    
+    return (uint8_t)(hash >> 25);
+}
+
+#if defined(TABLE_USE_SSE2)
+static inline int lowest_set_bit(int mask)
+{
+#if defined(_MSC_VER)
+    unsigned long index;
+    _BitScanForward(&index, (unsigned long)mask);
+    return (int)index;
+#else
+    return __builtin_ctz((unsigned)mask);
+#endif
+}
+#endif
+
+// Returns the slot holding `key`, or the slot an insertion should use. Groups
+// are aligned, so a 16-byte load never runs past the end of the metadata
+// array. Deleted slots decay to tombstones which only a rehash reclaims, which
+// is why a fragment match is safe to check before the empty scan: no full slot
+// can sit after an empty one that probing would have passed through.
+static uint32_t find_slot(const uint8_t* metadata, Entry* entries, int capacity, ObjectString* key, uint32_t hash)
+{
+    uint32_t mask = (uint32_t)capacity - 1;
+    uint32_t group = hash & mask & ~(uint32_t)(TABLE_GROUP_SIZE - 1);
+    uint8_t fragment = hash_fragment(hash);
+    int tombstone = -1;
+
     for (;;) {
-        Entry* entry = &entries[index];
-        if (entry->key == NULL) {
-            if (IS_NIL(entry->value)) {
-                // Empty entry.
-                return tombstone != NULL ? tombstone : entry;
-            }
-            else {
-                // We found a tombstone.
-                if (tombstone == NULL) tombstone = entry;
-            }
+#if defined(TABLE_USE_SSE2)
+        __m128i bytes = _mm_loadu_si128((const __m128i*)(metadata + group));
+
+        int matches = _mm_movemask_epi8(_mm_cmpeq_epi8(bytes, _mm_set1_epi8((char)fragment)));
+        while (matches != 0) {
+            uint32_t index = group + (uint32_t)lowest_set_bit(matches);
+            if (entries[index].key == key) return index;
+            matches &= matches - 1;
+        }
+
+        int empties = _mm_movemask_epi8(_mm_cmpeq_epi8(bytes, _mm_set1_epi8((char)(uint8_t)META_EMPTY)));
+        if (empties != 0) {
+            if (tombstone >= 0) return (uint32_t)tombstone;
+            return group + (uint32_t)lowest_set_bit(empties);
         }
-        else if (entry->key == key) {
-            // We found the key.
-            return entry;
+
+        if (tombstone < 0) {
+            int deleted = _mm_movemask_epi8(_mm_cmpeq_epi8(bytes, _mm_set1_epi8((char)(uint8_t)META_DELETED)));
+            if (deleted != 0) tombstone = (int)(group + (uint32_t)lowest_set_bit(deleted));
         }
-        index = (index + 1) % capacity;
+#else
+        for (int offset = 0; offset < TABLE_GROUP_SIZE; offset++) {
+            uint32_t index = group + (uint32_t)offset;
+            uint8_t meta = metadata[index];
+
+            if (meta == fragment && entries[index].key == key) return index;
+
+            if (meta == META_EMPTY) {
+                return tombstone >= 0 ? (uint32_t)tombstone : index;
+            }
+
+            if (meta == META_DELETED && tombstone < 0) tombstone = (int)index;
+        }
+#endif
+        group = (group + TABLE_GROUP_SIZE) & mask;
     }
 }
 
 static void adjust_capacity(Table* table, int capacity)
 {
     Entry* entries = ALLOCATE(Entry, capacity);
+    uint8_t* metadata = ALLOCATE(uint8_t, capacity);
     for (int i = 0; i < capacity; i++) {
         entries[i].key = NULL;
         entries[i].value = NIL_VALUE;
     }
-    
+    memset(metadata, META_EMPTY, capacity);
+
     table->count = 0;
     for (int i = 0; i < table->capacity; i++) {
         Entry* entry = &table->entries[i];
         if (entry->key == NULL) continue;
 
-        Entry* dest = find_entry(entries, capacity, entry->key);
-        dest->key = entry->key;
-        dest->value = entry->value;
+        uint32_t index = find_slot(metadata, entries, capacity, entry->key, entry->key->hash);
+        entries[index] = *entry;
+        metadata[index] = hash_fragment(entry->key->hash);
         table->count++;
     }
 
     FREE_ARRAY(Entry, table->entries, table->capacity);
+    FREE_ARRAY(uint8_t, table->metadata, table->capacity);
     table->entries = entries;
+    table->metadata = metadata;
     table->capacity = capacity;
 }
 
@@ -61,11 +129,13 @@ void init_table(Table* table)
     table->count = 0;
     table->capacity = 0;
     table->entries = NULL;
+    table->metadata = NULL;
 }
 
 void free_table(Table* table)
 {
     FREE_ARRAY(Entry, table->entries, table->capacity);
+    FREE_ARRAY(uint8_t, table->metadata, table->capacity);
     init_table(table);
 }
 
@@ -93,12 +163,14 @@ bool table_del(Table* table, ObjectString* key)
     if (table->count == 0) return false;
 
     // Find the entry.
-    Entry* entry = find_entry(table->entries, table->capacity, key);
+    uint32_t index = find_slot(table->metadata, table->entries, table->capacity, key, key->hash);
+    Entry* entry = &table->entries[index];
     if (entry->key == NULL) return false;
 
     // Place a tombstone in the entry.
     entry->key = NULL;
     entry->value = BOOL_VALUE(true);
+    table->metadata[index] = META_DELETED;
 
     return true;
 }
@@ -106,7 +178,7 @@ bool table_del(Table* table, ObjectString* key)
 bool table_get(Table* table, ObjectString* key, Value* value)
 {
     if (table->count == 0) return false;
-    Entry* entry = find_entry(table->entries, table->capacity, key);
+    Entry* entry = &table->entries[find_slot(table->metadata, table->entries, table->capacity, key, key->hash)];
     if (entry->key == NULL) return false;
     *value = entry->value;
     return true;
@@ -116,14 +188,17 @@ bool table_set(Table* table, ObjectString* key, Value value)
 {
     if (table->count + 1 > table->capacity * TABLE_MAX_LOAD) {
         int capacity = GROW_CAPACITY(table->capacity);
+        if (capacity < TABLE_MIN_CAPACITY) capacity = TABLE_MIN_CAPACITY;
         adjust_capacity(table, capacity);
     }
 
-    Entry* entry = find_entry(table->entries, table->capacity, key);
+    uint32_t index = find_slot(table->metadata, table->entries, table->capacity, key, key->hash);
+    Entry* entry = &table->entries[index];
     bool is_new_key = entry->key == NULL;
     if (is_new_key && IS_NIL(entry->value)) table->count++;
     entry->key = key;
     entry->value = value;
+    table->metadata[index] = hash_fragment(key->hash);
     return is_new_key;
 }
 
@@ -131,31 +206,64 @@ ObjectString* table_find_string(Table* table, const char* chars, int length, uin
 {
     if (table->count == 0) return NULL;
 
-    uint32_t index = hash % table->capacity;
+    uint32_t mask = (uint32_t)table->capacity - 1;
+    uint32_t group = hash & mask & ~(uint32_t)(TABLE_GROUP_SIZE - 1);
+    uint8_t fragment = hash_fragment(hash);
 
     for (;;) {
-        Entry* entry = &table->entries[index];
+#if defined(TABLE_USE_SSE2)
+        __m128i bytes = _mm_loadu_si128((const __m128i*)(table->metadata + group));
 
-        if (entry->key == NULL) {
-            // Stop if we find an empty non-tombstone entry.
-            if (IS_NIL(entry->value)) return NULL;
-        }
-        else if (entry->key->length == length &&
-            entry->key->hash == hash &&
-            memcmp(entry->key->chars, chars, length) == 0) {
-            // We found it.
-            return entry->key;
+        int matches = _mm_movemask_epi8(_mm_cmpeq_epi8(bytes, _mm_set1_epi8((char)fragment)));
+        while (matches != 0) {
+            ObjectString* key = table->entries[group + (uint32_t)lowest_set_bit(matches)].key;
+            if (key->length == length &&
+                key->hash == hash &&
+                memcmp(key->chars, chars, length) == 0) {
+                // We found it.
+                return key;
+            }
+            matches &= matches - 1;
         }
 
-        index = (index + 1) % table->capacity;
+        // Stop at the first group with an empty non-tombstone slot.
+        if (_mm_movemask_epi8(_mm_cmpeq_epi8(bytes, _mm_set1_epi8((char)(uint8_t)META_EMPTY))) != 0)
+            return NULL;
+#else
+        for (int offset = 0; offset < TABLE_GROUP_SIZE; offset++) {
+            uint32_t index = group + (uint32_t)offset;
+            uint8_t meta = table->metadata[index];
+
+            if (meta == fragment) {
+                ObjectString* key = table->entries[index].key;
+                if (key->length == length &&
+                    key->hash == hash &&
+                    memcmp(key->chars, chars, length) == 0) {
+                    // We found it.
+                    return key;
+                }
+            }
+
+            // Stop if we find an empty non-tombstone entry.
+            if (meta == META_EMPTY) return NULL;
+        }
+#endif
+        group = (group + TABLE_GROUP_SIZE) & mask;
     }
 }
 
-void table_remove_white(Table* table)
+void table_remove_white(Table* table, bool include_old)
 {
     for (int i = 0; i < table->capacity; i++) {
         Entry* entry = &table->entries[i];
-        if (entry->key != NULL && !entry->key->object.is_marked)
-            table_del(table, entry->key);
+        if (entry->key == NULL || entry->key->object.is_marked)
+            continue;
+
+        // A minor collection never marks the old generation, so old keys
+        // are only reclaimable during a full collection.
+        if (!include_old && entry->key->object.is_old)
+            continue;
+
+        table_del(table, entry->key);
     }
 }
@@ -9,25 +9,57 @@
 
 void print_value(Value value)
 {
+#ifdef NAN_BOXING
+    if (IS_NIL(value)) {
+        printf("nil");
+    } else if (IS_BOOL(value)) {
+        printf(AS_BOOL(value) ? "true" : "false");
+    } else if (IS_NUMBER(value)) {
+        printf("%g", AS_NUMBER(value));
+    } else if (IS_OBJECT(value)) {
+        print_object(value);
+    }
+#else
     switch (value.type) {
     case VALUE_NIL: printf("nil"); break;
     case VALUE_BOOL: printf(AS_BOOL(value) ? "true" : "false"); break;
     case VALUE_NUMBER: printf("%g", AS_NUMBER(value)); break;
     case VALUE_OBJECT: print_object(value); break;
     }
+#endif
 }
 
 bool values_equal(Value a, Value b)
 {
+#ifdef NAN_BOXING
+    // Compare doubles numerically so NaN != NaN holds; every other value
+    // is equal exactly when the bit patterns match.
+    if (IS_NUMBER(a) && IS_NUMBER(b)) {
+        return AS_NUMBER(a) == AS_NUMBER(b);
+    }
+    if (IS_ROPE(a) || IS_ROPE(b)) {
+        // Flattened strings are interned, so content equality reduces to
+        // pointer identity again.
+        if (!is_string_like(a) || !is_string_like(b)) return false;
+        return flatten_string(a) == flatten_string(b);
+    }
+    return a == b;
+#else
     if (a.type != b.type) return false;
 
     switch (a.type) {
     case VALUE_NIL:     return true;
     case VALUE_BOOL:    return AS_BOOL(a) == AS_BOOL(b);
     case VALUE_NUMBER:  return AS_NUMBER(a) == AS_NUMBER(b);
-    case VALUE_OBJECT:  return AS_OBJECT(a) == AS_OBJECT(b);
+    case VALUE_OBJECT:
+        if (IS_ROPE(a) || IS_ROPE(b)) {
+            if (!is_string_like(a) || !is_string_like(b)) return false;
+            return flatten_string(a) == flatten_string(b);
+        }
+        return AS_OBJECT(a) == AS_OBJECT(b);
     default: return false;
     }
+#endif
 }
 
 void init_value_array(ValueArray* array)
@@ -1,4 +1,5 @@
 #include "compiler.h"
+#include "optimizer.h"
 #include "memory.h"
 #include "object.h"
 #include "common.h"
@@ -9,32 +10,277 @@
 #include <string.h>
 #include <stdarg.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
 #include <time.h>
 
-VM vm;
+CLOX_THREAD_LOCAL VM* vm = NULL;
 
 static Value clock_native(int arg_count, Value* args)
 {
     return NUMBER_VALUE((double)clock() / CLOCKS_PER_SEC);
 }
 
+static Value append_native(int arg_count, Value* args)
+{
+    ObjectList* list = AS_LIST(args[0]);
+    write_value_array(&list->items, args[1]);
+    gc_write_barrier((Object*)list, args[1]);
+    return args[0];
+}
+
+static Value len_native(int arg_count, Value* args)
+{
+    if (IS_LIST(args[0]))
+        return NUMBER_VALUE(AS_LIST(args[0])->items.count);
+    if (is_string_like(args[0]))
+        return NUMBER_VALUE(string_like_length(args[0]));
+    return NIL_VALUE;
+}
+
+static Value floor_native(int arg_count, Value* args)
+{
+    return NUMBER_VALUE(floor(AS_NUMBER(args[0])));
+}
+
+static Value sqrt_native(int arg_count, Value* args)
+{
+    return NUMBER_VALUE(sqrt(AS_NUMBER(args[0])));
+}
+
+static Value abs_native(int arg_count, Value* args)
+{
+    return NUMBER_VALUE(fabs(AS_NUMBER(args[0])));
+}
+
+// substr(string, start, count) -> new string, or nil when the range
+// falls outside the string.
+static Value substr_native(int arg_count, Value* args)
+{
+    ObjectString* string = flatten_string(args[0]);
+    double start_arg = AS_NUMBER(args[1]);
+    double count_arg = AS_NUMBER(args[2]);
+
+    int start = (int)start_arg;
+    int count = (int)count_arg;
+    if (start != start_arg || count != count_arg || start < 0 || count < 0
+        || start > string->length - count)
+        return NIL_VALUE;
+
+    return OBJECT_VALUE(copy_string(string->chars + start, count));
+}
+
+// find(haystack, needle) -> index of the first occurrence, or -1.
+// Ropes memoize their flattened string, so the haystack stays reachable
+// through args[0] while flattening the needle allocates.
+static Value find_native(int arg_count, Value* args)
+{
+    ObjectString* haystack = flatten_string(args[0]);
+    ObjectString* needle   = flatten_string(args[1]);
+
+    if (needle->length == 0)
+        return NUMBER_VALUE(0);
+
+    for (int i = 0; i <= haystack->length - needle->length; i++) {
+        if (memcmp(haystack->chars + i, needle->chars, needle->length) == 0)
+            return NUMBER_VALUE(i);
+    }
+    return NUMBER_VALUE(-1);
+}
+
+// pop(list) -> removes and returns the last element, nil when empty.
+static Value pop_native(int arg_count, Value* args)
+{
+    ObjectList* list = AS_LIST(args[0]);
+    if (list->items.count == 0)
+        return NIL_VALUE;
+
+    return list->items.values[--list->items.count];
+}
+
+// indexOf(list, value) -> first index holding an equal value, or -1.
+static Value index_of_native(int arg_count, Value* args)
+{
+    ObjectList* list = AS_LIST(args[0]);
+    for (int i = 0; i < list->items.count; i++) {
+        if (values_equal(list->items.values[i], args[1]))
+            return NUMBER_VALUE(i);
+    }
+    return NUMBER_VALUE(-1);
+}
+
+// slice(list, start, count) -> new list, or nil when the range falls
+// outside the list.
+static Value slice_native(int arg_count, Value* args)
+{
+    ObjectList* list = AS_LIST(args[0]);
+    double start_arg = AS_NUMBER(args[1]);
+    double count_arg = AS_NUMBER(args[2]);
+
+    int start = (int)start_arg;
+    int count = (int)count_arg;
+    if (start != start_arg || count != count_arg || start < 0 || count < 0
+        || start > list->items.count - count)
+        return NIL_VALUE;
+
+    ObjectList* result = new_list();
+    stack_push(OBJECT_VALUE(result));
+    for (int i = 0; i < count; i++) {
+        write_value_array(&result->items, list->items.values[start + i]);
+    }
+    return stack_pop();
+}
+
+// reverse(list) -> reverses the list in place and returns it.
+static Value reverse_native(int arg_count, Value* args)
+{
+    ObjectList* list = AS_LIST(args[0]);
+    for (int i = 0, j = list->items.count - 1; i < j; i++, j--) {
+        Value temporary        = list->items.values[i];
+        list->items.values[i]  = list->items.values[j];
+        list->items.values[j]  = temporary;
+    }
+    return args[0];
+}
+
+static Value gc_collect_native(int arg_count, Value* args)
+{
+    collect_garbage();
+    return NIL_VALUE;
+}
+
+// [minor cycles, major cycles, total pause, max pause, bytes allocated].
+static Value gc_stats_native(int arg_count, Value* args)
+{
+    ObjectList* stats = new_list();
+    stack_push(OBJECT_VALUE(stats));
+
+    write_value_array(&stats->items, NUMBER_VALUE(vm->gc_minor_cycles));
+    write_value_array(&stats->items, NUMBER_VALUE(vm->gc_major_cycles));
+    write_value_array(&stats->items, NUMBER_VALUE(vm->gc_total_pause));
+    write_value_array(&stats->items, NUMBER_VALUE(vm->gc_max_pause));
+    write_value_array(&stats->items, NUMBER_VALUE((double)vm->bytes_allocated));
+
+    return stack_pop();
+}
+
+// Live object counts indexed by ObjectType, across both generations.
+static Value gc_objects_native(int arg_count, Value* args)
+{
+    double counts[OBJECT_TYPE_COUNT] = { 0 };
+    for (Object* object = vm->objects; object != NULL; object = object->next)
+        counts[object->type]++;
+    for (Object* object = vm->old_objects; object != NULL; object = object->next)
+        counts[object->type]++;
+
+    ObjectList* list = new_list();
+    stack_push(OBJECT_VALUE(list));
+    for (int i = 0; i < OBJECT_TYPE_COUNT; i++) {
+        write_value_array(&list->items, NUMBER_VALUE(counts[i]));
+    }
+
+    return stack_pop();
+}
+
+static Value profile_report_native(int arg_count, Value* args)
+{
+    profile_report();
+    return NIL_VALUE;
+}
+
+// gcTune(next full collection threshold in bytes, heap growth factor).
+static Value gc_tune_native(int arg_count, Value* args)
+{
+    double threshold = AS_NUMBER(args[0]);
+    double factor    = AS_NUMBER(args[1]);
+    if (threshold < 0 || factor < 1)
+        return NIL_VALUE;
+
+    vm->next_gc        = (size_t)threshold;
+    vm->gc_grow_factor = factor;
+    return BOOL_VALUE(true);
+}
+
+// fiber(fn) wraps a function in a new suspended fiber. Calling the fiber
+// resumes it; 'yield' inside it suspends back to the caller.
+static Value fiber_native(int arg_count, Value* args)
+{
+    return OBJECT_VALUE(new_fiber(AS_OBJECT(args[0])));
+}
+
+static Value fiber_done_native(int arg_count, Value* args)
+{
+    return BOOL_VALUE(AS_FIBER(args[0])->state == FIBER_DONE);
+}
+
 static void reset_stack()
 {
-    vm.open_upvalues = NULL;
-    vm.stack_top     = vm.stack;
-    vm.frame_count   = 0;
+    if (vm->fiber == NULL)
+        return;
+
+    // Unwind to the main fiber; whatever was suspended stays parked.
+    while (vm->fiber->caller != NULL) {
+        vm->fiber = vm->fiber->caller;
+    }
+
+    memset(vm->fiber->open_upvalues, 0,
+           sizeof(ObjectUpvalue*) * vm->fiber->stack_capacity);
+    vm->fiber->stack_top   = vm->fiber->stack;
+    vm->fiber->frame_count = 0;
+    vm->fiber->state       = FIBER_RUNNING;
+}
+
+// Doubles the fiber's value stack. The buffer can move, so every
+// interior pointer into it -- the top, each frame's window, each open
+// upvalue's location -- is rebased before anything else can allocate.
+static void grow_fiber_stack(ObjectFiber* fiber)
+{
+    int old_capacity = fiber->stack_capacity;
+    int top          = (int)(fiber->stack_top - fiber->stack);
+    int slot_offsets[FRAMES_MAX];
+    for (int i = 0; i < fiber->frame_count; i++) {
+        slot_offsets[i] = (int)(fiber->frames[i].slots - fiber->stack);
+    }
+
+    fiber->stack_capacity = old_capacity * 2;
+    fiber->stack = GROW_ARRAY(Value, fiber->stack, old_capacity, fiber->stack_capacity);
+
+    fiber->stack_top = fiber->stack + top;
+    for (int i = 0; i < fiber->frame_count; i++) {
+        fiber->frames[i].slots = fiber->stack + slot_offsets[i];
+    }
+    // Every entry in the table is open, so its location is its own slot.
+    for (int i = 0; i < old_capacity; i++) {
+        if (fiber->open_upvalues[i] != NULL) {
+            fiber->open_upvalues[i]->location = fiber->stack + i;
+        }
+    }
+
+    fiber->open_upvalues = GROW_ARRAY(ObjectUpvalue*, fiber->open_upvalues,
+                                      old_capacity, fiber->stack_capacity);
+    for (int i = old_capacity; i < fiber->stack_capacity; i++) {
+        fiber->open_upvalues[i] = NULL;
+    }
 }
 
 void stack_push(Value value)
 {
-    *vm.stack_top = value;
-    vm.stack_top++;
+    ObjectFiber* fiber = vm->fiber;
+    if (fiber->stack_top == fiber->stack + fiber->stack_capacity) {
+        // The growth can collect before value reaches the stack; the
+        // guard slot keeps it alive through the reallocation.
+        vm->push_guard = value;
+        grow_fiber_stack(fiber);
+        vm->push_guard = NIL_VALUE;
+    }
+    *fiber->stack_top = value;
+    fiber->stack_top++;
 }
 
 Value stack_pop()
 {
-    vm.stack_top--;
-    return *vm.stack_top;
+    vm->fiber->stack_top--;
+    return *vm->fiber->stack_top;
 }
 
 static void runtime_error(const char* format, ...)
@@ -45,52 +291,225 @@ static void runtime_error(const char* format, ...)
     va_end(args);
     fputs("\n", stderr);
 
-    for (int i = vm.frame_count - 1; i >= 0; i--) {
-        CallFrame* frame = &vm.frames[i];
-        ObjectFunction* function = frame->closure->function;
-        // -1 because the IP is sitting on the next instruction to be executed.
-        size_t instruction = frame->ip - function->chunk.code - 1;
-        fprintf(stderr, "[line %d] in ", function->chunk.lines[instruction]);
-        if (function->name == NULL) {
-            fprintf(stderr, "script\n");
-        } else {
-            fprintf(stderr, "%s()\n", function->name->chars);
+    for (ObjectFiber* fiber = vm->fiber; fiber != NULL; fiber = fiber->caller) {
+        for (int i = fiber->frame_count - 1; i >= 0; i--) {
+            CallFrame* frame = &fiber->frames[i];
+            ObjectFunction* function = frame->function;
+            // -1 because the IP is sitting on the next instruction to be executed.
+            size_t instruction = frame->ip - function->chunk.code - 1;
+            fprintf(stderr, "[line %d] in ", function->chunk.lines[instruction]);
+            if (function->name == NULL) {
+                fprintf(stderr, "script\n");
+            } else {
+                fprintf(stderr, "%s()\n", function->name->chars);
+            }
         }
     }
 
     reset_stack();
 }
 
-static void define_native(const char* name, NativeFn function)
+// Returns the flat slot assigned to a global name, reserving a new
+// EMPTY-initialized slot on first sight. The mapping lives in the VM so
+// it survives across REPL lines.
+int vm_global_slot(ObjectString* name)
+{
+    Value index;
+    if (table_get(&vm->global_names, name, &index)) {
+        return (int)AS_NUMBER(index);
+    }
+
+    stack_push(OBJECT_VALUE(name));
+    write_value_array(&vm->global_slots, EMPTY_VALUE);
+    table_set(&vm->global_names, name, NUMBER_VALUE(vm->global_slots.count - 1));
+    stack_pop();
+    return vm->global_slots.count - 1;
+}
+
+ObjectString* global_name(int slot)
+{
+    for (int i = 0; i < vm->global_names.capacity; i++) {
+        Entry* entry = &vm->global_names.entries[i];
+        if (entry->key != NULL && (int)AS_NUMBER(entry->value) == slot) {
+            return entry->key;
+        }
+    }
+    return NULL;
+}
+
+static void define_native(const char* name, NativeFn function, int arity, const char* params)
 {
     stack_push(OBJECT_VALUE(copy_string(name, (int)strlen(name))));
-    stack_push(OBJECT_VALUE(new_native(function)));
-    table_set(&vm.globals, AS_STRING(vm.stack[0]), vm.stack[1]);
+    stack_push(OBJECT_VALUE(new_native(function, name, arity, params)));
+    int slot = vm_global_slot(AS_STRING(vm->fiber->stack[0]));
+    vm->global_slots.values[slot] = vm->fiber->stack[1];
     stack_pop();
     stack_pop();
 }
 
 static Value peek(int distance)
 {
-    return vm.stack_top[-1 - distance];
+    return vm->fiber->stack_top[-1 - distance];
 }
 
-static bool call(ObjectClosure* closure, int arg_count)
+// closure is NULL for a bare ObjectFunction; only functions that actually
+// capture something are ever wrapped in an ObjectClosure, and only they
+// execute the upvalue opcodes that reach through frame->closure.
+static bool call_callable(ObjectClosure* closure, ObjectFunction* function, int arg_count)
 {
-    if (arg_count != closure->function->arity) {
-        runtime_error("Expected %d arguments but got %d instead.", closure->function->arity, arg_count);
+    if (arg_count != function->arity) {
+        runtime_error("Expected %d arguments but got %d instead.", function->arity, arg_count);
         return false;
     }
 
-    if (vm.frame_count == FRAMES_MAX) {
+    if (vm->fiber->frame_count == FRAMES_MAX) {
         runtime_error("Stack overflow.");
         return false;
     }
 
-    CallFrame* frame = &vm.frames[vm.frame_count++];
+    if (vm->fiber->frame_count == vm->fiber->frame_capacity) {
+        int old_capacity = vm->fiber->frame_capacity;
+        vm->fiber->frame_capacity = old_capacity * 2 > FRAMES_MAX ? FRAMES_MAX : old_capacity * 2;
+        vm->fiber->frames = GROW_ARRAY(CallFrame, vm->fiber->frames,
+                                       old_capacity, vm->fiber->frame_capacity);
+    }
+
+    if (!function->tiered && ++function->heat >= TIER_UP_HEAT) {
+        function->tiered = true;
+        quicken_chunk(&function->chunk);
+    }
+
+    CallFrame* frame = &vm->fiber->frames[vm->fiber->frame_count++];
     frame->closure  = closure;
-    frame->slots    = vm.stack_top - arg_count - 1;
-    frame->ip       = closure->function->chunk.code;
+    frame->function = function;
+    frame->slots    = vm->fiber->stack_top - arg_count - 1;
+    frame->ip       = function->chunk.code;
+
+#ifdef VM_PROFILE
+    function->invocations++;
+    frame->profile_start = clock();
+#endif
+    return true;
+}
+
+static bool call(ObjectClosure* closure, int arg_count)
+{
+    return call_callable(closure, closure->function, arg_count);
+}
+
+// Dispatches a method or callee that is either a closure or a bare function.
+static bool call_object(Object* callable, int arg_count)
+{
+    if (callable->type == OBJECT_CLOSURE) {
+        return call((ObjectClosure*)callable, arg_count);
+    }
+    return call_callable(NULL, (ObjectFunction*)callable, arg_count);
+}
+
+// A finished fiber never runs again, so its stacks go back to the pool
+// immediately instead of waiting for the collector.
+static void release_fiber(ObjectFiber* fiber)
+{
+    fiber->state    = FIBER_DONE;
+    fiber->caller   = NULL;
+    fiber->callable = NULL;
+    FREE_ARRAY(Value, fiber->stack, fiber->stack_capacity);
+    FREE_ARRAY(ObjectUpvalue*, fiber->open_upvalues, fiber->stack_capacity);
+    FREE_ARRAY(CallFrame, fiber->frames, fiber->frame_capacity);
+    fiber->stack          = NULL;
+    fiber->stack_top      = NULL;
+    fiber->stack_capacity = 0;
+    fiber->open_upvalues  = NULL;
+    fiber->frames         = NULL;
+    fiber->frame_capacity = 0;
+}
+
+// Finds the fiber that should receive a value coming back down the
+// caller chain. A fiber with no frames left resumed another fiber from
+// tail position -- its last frame was recycled by OP_TAIL_CALL -- so the
+// incoming value is also its own result and keeps cascading. The main
+// fiber always keeps its script frame, so the walk terminates.
+static ObjectFiber* unwind_to_live_fiber(ObjectFiber* target)
+{
+    while (target->frame_count == 0 && target->caller != NULL) {
+        ObjectFiber* next = target->caller;
+        release_fiber(target);
+        target = next;
+    }
+    return target;
+}
+
+// Transfers control to 'fiber'. The resume call's operands are popped
+// from the resuming fiber's stack; the value the fiber later hands back
+// through yield or return is pushed there in their place.
+static bool resume_fiber(ObjectFiber* fiber, int arg_count)
+{
+    if (arg_count > 1) {
+        runtime_error("Can't resume a fiber with more than one value.");
+        return false;
+    }
+    if (fiber->state == FIBER_DONE) {
+        runtime_error("Can't resume a finished fiber.");
+        return false;
+    }
+    if (fiber->state == FIBER_RUNNING) {
+        runtime_error("Fiber is already running.");
+        return false;
+    }
+
+    Value arg = arg_count == 1 ? peek(0) : NIL_VALUE;
+    vm->fiber->stack_top -= arg_count + 1;
+
+    fiber->caller = vm->fiber;
+    vm->fiber     = fiber;
+
+    if (fiber->state == FIBER_NEW) {
+        fiber->state = FIBER_RUNNING;
+        stack_push(OBJECT_VALUE(fiber->callable));
+        if (arg_count == 1) {
+            stack_push(arg);
+        }
+        return call_object(fiber->callable, arg_count);
+    }
+
+    // Suspended mid-yield: the argument becomes the yield's value.
+    fiber->state = FIBER_RUNNING;
+    stack_push(arg);
+    return true;
+}
+
+// Enforces one declared parameter of a typed native; the code letters
+// are documented next to ObjectNative in object.h.
+static bool check_native_arg(ObjectNative* native, int index, Value arg)
+{
+    const char* expected = NULL;
+    switch (native->params[index]) {
+    case 'n':
+        if (!IS_NUMBER(arg)) expected = "a number";
+        break;
+    case 's':
+        if (!is_string_like(arg)) expected = "a string";
+        break;
+    case 'l':
+        if (!IS_LIST(arg)) expected = "a list";
+        break;
+    case 'c':
+        if (!IS_OBJECT(arg) || (OBJECT_TYPE(arg) != OBJECT_CLOSURE
+                                && OBJECT_TYPE(arg) != OBJECT_FUNCTION))
+            expected = "a function";
+        break;
+    case 'f':
+        if (!IS_FIBER(arg)) expected = "a fiber";
+        break;
+    default:
+        break;
+    }
+
+    if (expected != NULL) {
+        runtime_error("Argument %d to '%s' must be %s.",
+                      index + 1, native->name, expected);
+        return false;
+    }
     return true;
 }
 
@@ -100,16 +519,16 @@ static bool call_value(Value callee, int arg_count)
         switch (OBJECT_TYPE(callee)) {
         case OBJECT_BOUND_METHOD: {
             ObjectBoundMethod* bound = AS_BOUND_METHOD(callee);
-            vm.stack_top[-arg_count - 1] = bound->reciever;
-            return call(bound->method, arg_count);
+            vm->fiber->stack_top[-arg_count - 1] = bound->reciever;
+            return call_object(bound->method, arg_count);
         }
         case OBJECT_CLASS: {
             ObjectClass* klass = AS_CLASS(callee);
-            vm.stack_top[-arg_count - 1] = OBJECT_VALUE(new_instance(klass));
+            vm->fiber->stack_top[-arg_count - 1] = OBJECT_VALUE(new_instance(klass));
             
             Value initializer;
-            if (table_get(&klass->methods, vm.init_string, &initializer)) {
-                return call(AS_CLOSURE(initializer), arg_count);
+            if (table_get(&klass->methods, vm->init_string, &initializer)) {
+                return call_object(AS_OBJECT(initializer), arg_count);
             } else if(arg_count != 0) {
                 runtime_error("Expected 0 arguments but got %d.", arg_count);
             }
@@ -119,10 +538,29 @@ static bool call_value(Value callee, int arg_count)
         case OBJECT_CLOSURE: {
             return call(AS_CLOSURE(callee), arg_count);
         }
+        case OBJECT_FUNCTION: {
+            return call_callable(NULL, AS_FUNCTION(callee), arg_count);
+        }
+        case OBJECT_FIBER: {
+            return resume_fiber(AS_FIBER(callee), arg_count);
+        }
         case OBJECT_NATIVE: {
-            NativeFn native = AS_NATIVE(callee);
-            Value result = native(arg_count, vm.stack_top - arg_count);
-            vm.stack_top -= arg_count + 1;
+            ObjectNative* native = (ObjectNative*)AS_OBJECT(callee);
+            if (native->arity >= 0) {
+                if (arg_count != native->arity) {
+                    runtime_error("Expected %d arguments but got %d instead.",
+                                  native->arity, arg_count);
+                    return false;
+                }
+                Value* args = vm->fiber->stack_top - arg_count;
+                for (int i = 0; i < arg_count; i++) {
+                    if (!check_native_arg(native, i, args[i]))
+                        return false;
+                }
+            }
+
+            Value result = native->function(arg_count, vm->fiber->stack_top - arg_count);
+            vm->fiber->stack_top -= arg_count + 1;
             stack_push(result);
             return true;
         }
@@ -134,18 +572,32 @@ static bool call_value(Value callee, int arg_count)
     return false;
 }
 
-static bool invoke_from_class(ObjectClass* klass, ObjectString* name, int arg_count)
+static bool invoke_from_class(ObjectClass* klass, ObjectString* name, int arg_count, InvokeCache* cache)
 {
+    for (int i = 0; i < INVOKE_CACHE_SIZE; i++) {
+        if (cache->klass[i] == klass) {
+            return call_object(cache->method[i], arg_count);
+        }
+    }
+
     Value method;
     if (!table_get(&klass->methods, name, &method)) {
         runtime_error("Undefined property '%s'.", name->chars);
         return false;
     }
 
-    return call(AS_CLOSURE(method), arg_count);
+    // Insert most-recent-first so monomorphic sites hit on one compare.
+    for (int i = INVOKE_CACHE_SIZE - 1; i > 0; i--) {
+        cache->klass[i]  = cache->klass[i - 1];
+        cache->method[i] = cache->method[i - 1];
+    }
+    cache->klass[0]  = klass;
+    cache->method[0] = AS_OBJECT(method);
+
+    return call_object(AS_OBJECT(method), arg_count);
 }
 
-static bool invoke(ObjectString* name, int arg_count)
+static bool invoke(ObjectString* name, int arg_count, InvokeCache* cache)
 {
     Value reciever = peek(arg_count);
 
@@ -156,13 +608,18 @@ static bool invoke(ObjectString* name, int arg_count)
 
     ObjectInstance* instance = AS_INSTANCE(reciever);
 
-    Value value;
-    if (table_get(&instance->fields, name, &value)) {
-        vm.stack_top[-arg_count - 1] = value;
-        return call_value(value, arg_count);
+    // Fields can shadow methods, but most receivers on the hot path have
+    // no fields with the invoked name; only probe when there are any.
+    if (instance->shape->field_count > 0) {
+        int slot = shape_slot(instance->shape, name);
+        if (slot != -1) {
+            Value value = instance->fields[slot];
+            vm->fiber->stack_top[-arg_count - 1] = value;
+            return call_value(value, arg_count);
+        }
     }
 
-    return invoke_from_class(instance->klass, name, arg_count);
+    return invoke_from_class(instance->klass, name, arg_count, cache);
 }
 
 static bool bind_method(ObjectClass* klass, ObjectString* name)
@@ -173,7 +630,7 @@ static bool bind_method(ObjectClass* klass, ObjectString* name)
         return false;
     }
 
-    ObjectBoundMethod* bound = new_bound_method(peek(0), AS_CLOSURE(method));
+    ObjectBoundMethod* bound = new_bound_method(peek(0), AS_OBJECT(method));
     stack_pop();
     stack_push(OBJECT_VALUE(bound));
     return true;
@@ -181,47 +638,74 @@ static bool bind_method(ObjectClass* klass, ObjectString* name)
 
 static ObjectUpvalue* capture_upvalue(Value* local)
 {
-    ObjectUpvalue* previous = NULL;
-    ObjectUpvalue* upvalue  = vm.open_upvalues;
-
-    while (upvalue != NULL && upvalue->location > local) {
-        previous = upvalue;
-        upvalue  = upvalue->next;
-    }
-
-    if (upvalue != NULL && upvalue->location == local) {
-        return upvalue;
+    int slot = (int)(local - vm->fiber->stack);
+    if (vm->fiber->open_upvalues[slot] != NULL) {
+        return vm->fiber->open_upvalues[slot];
     }
 
     ObjectUpvalue* created_upvalue = new_upvalue(local);
-    created_upvalue->next = upvalue;
-
-    if (previous == NULL) {
-        vm.open_upvalues = created_upvalue;
-    } else {
-        previous->next = created_upvalue;
-    }
+    vm->fiber->open_upvalues[slot] = created_upvalue;
     return created_upvalue;
 }
 
+// Only slots below stack_top can be open, and callers close before
+// popping, so the scan is bounded by the region being discarded.
 static void close_upvalues(Value* last)
 {
-    while (vm.open_upvalues != NULL && vm.open_upvalues->location >= last) {
-        ObjectUpvalue* upvalue = vm.open_upvalues;
+    for (Value* location = last; location < vm->fiber->stack_top; location++) {
+        int slot = (int)(location - vm->fiber->stack);
+        ObjectUpvalue* upvalue = vm->fiber->open_upvalues[slot];
+        if (upvalue == NULL)
+            continue;
+
         upvalue->closed   = *upvalue->location;
         upvalue->location = &upvalue->closed;
-        vm.open_upvalues  = upvalue->next;
+        vm->fiber->open_upvalues[slot] = NULL;
+        gc_write_barrier((Object*)upvalue, upvalue->closed);
     }
 }
 
+// Ensure the flat field array can hold 'slot'. Grown capacity is left
+// uninitialized past the shape's field count; a slot only becomes
+// readable once the transition that names it has stored its value.
+static void ensure_field_capacity(ObjectInstance* instance, int slot)
+{
+    if (slot < instance->field_capacity)
+        return;
+
+    int old_capacity = instance->field_capacity;
+    instance->field_capacity = GROW_CAPACITY(old_capacity);
+    instance->fields = GROW_ARRAY(Value, instance->fields, old_capacity, instance->field_capacity);
+}
+
 static void define_method(ObjectString* name)
 {
     Value method = peek(0);
     ObjectClass* klass = AS_CLASS(peek(1));
     table_set(&klass->methods, name, method);
+    gc_write_barrier((Object*)klass, OBJECT_VALUE(name));
+    gc_write_barrier((Object*)klass, method);
     stack_pop();
 }
 
+static PropertyCache* property_cache(Chunk* chunk, int site)
+{
+    if (chunk->caches == NULL) {
+        chunk->caches = ALLOCATE(PropertyCache, chunk->count);
+        memset(chunk->caches, 0, sizeof(PropertyCache) * chunk->count);
+    }
+    return &chunk->caches[site];
+}
+
+static InvokeCache* invoke_cache(Chunk* chunk, int site)
+{
+    if (chunk->invoke_caches == NULL) {
+        chunk->invoke_caches = ALLOCATE(InvokeCache, chunk->count);
+        memset(chunk->invoke_caches, 0, sizeof(InvokeCache) * chunk->count);
+    }
+    return &chunk->invoke_caches[site];
+}
+
 static bool is_falsey(Value value)
 {
     return IS_NIL(value) || (IS_BOOL(value) && !AS_BOOL(value));
@@ -229,28 +713,21 @@ static bool is_falsey(Value value)
 
 static void concatenate()
 {
-    ObjectString* b = AS_STRING(peek(0));
-    ObjectString* a = AS_STRING(peek(1));
-
-    int length = a->length + b->length;
-    char* chars = ALLOCATE(char, length + 1);
-    memcpy(chars, a->chars, a->length);
-    memcpy(chars + a->length, b->chars, b->length);
-    chars[length] = '\0';
-
-    ObjectString* result = take_string(chars, length);
-    stack_pop(); 
+    // O(1): link a rope over the operands and let whoever observes the
+    // result pay for one linear flatten.
+    ObjectRope* result = new_rope(peek(1), peek(0));
+    stack_pop();
     stack_pop();
     stack_push(OBJECT_VALUE(result));
 }
 
 static InterpretResult run()
 {
-    CallFrame* frame = &vm.frames[vm.frame_count - 1];
+    CallFrame* frame = &vm->fiber->frames[vm->fiber->frame_count - 1];
 
 #   define READ_BYTE()     (*frame->ip++)
 #   define READ_SHORT()    ( frame->ip += 2, (uint16_t)((frame->ip[-2] << 8) | frame->ip[-1]))
-#   define READ_CONSTANT() (frame->closure->function->chunk.constants.values[READ_BYTE()])
+#   define READ_CONSTANT() (frame->function->chunk.constants.values[READ_BYTE()])
 #   define READ_STRING() AS_STRING(READ_CONSTANT())
 #   define BINARY_OP(valueType, op) \
     do { \
@@ -263,23 +740,120 @@ static InterpretResult run()
         stack_push(valueType(a op b)); \
     } while(false)
 
-    for (;;) {
-#       ifdef DEBUG_TRACE_EXECUTION
-        printf("          ");
-        for (Value* slot = vm.stack + 1; slot < vm.stack_top; slot++) {
-            printf("[ ");
-            print_value(*slot);
-            printf(" ]");
-        }
-        printf("\n");
-        disassemble_instruction(&frame->closure->function->chunk, (int)(frame->ip - frame->closure->function->chunk.code));
-#       endif
+#   ifdef VM_PROFILE
+#   define VM_PROFILE_OP(op) (vm->opcode_counts[op]++)
+#   else
+#   define VM_PROFILE_OP(op) do {} while (false)
+#   endif
 
-        uint8_t instr;
-        switch (instr = READ_BYTE()) {
+#   ifdef DEBUG_TRACE_EXECUTION
+#   define VM_TRACE() \
+    do { \
+        printf("          "); \
+        for (Value* slot = vm->fiber->stack + 1; slot < vm->fiber->stack_top; slot++) { \
+            printf("[ "); \
+            print_value(*slot); \
+            printf(" ]"); \
+        } \
+        printf("\n"); \
+        disassemble_instruction(&frame->function->chunk, (int)(frame->ip - frame->function->chunk.code)); \
+    } while (false)
+#   else
+#   define VM_TRACE() do {} while (false)
+#   endif
+
+#   ifdef VM_THREADED_DISPATCH
+    // Direct-threaded dispatch: every handler jumps straight to the next
+    // one through its own goto, so the branch predictor sees one indirect
+    // branch per opcode instead of a single shared one for the whole loop.
+    // The table is keyed by OPCode and has to list every opcode.
+    static void* dispatch_table[] = {
+        [OP_CALL]          = &&vm_target_OP_CALL,
+        [OP_INVOKE]        = &&vm_target_OP_INVOKE,
+        [OP_SUPER_INVOKE]  = &&vm_target_OP_SUPER_INVOKE,
+        [OP_TAIL_CALL]     = &&vm_target_OP_TAIL_CALL,
+        [OP_TAIL_INVOKE]   = &&vm_target_OP_TAIL_INVOKE,
+        [OP_RETURN]        = &&vm_target_OP_RETURN,
+        [OP_YIELD]         = &&vm_target_OP_YIELD,
+        [OP_POP]           = &&vm_target_OP_POP,
+        [OP_PRINT]         = &&vm_target_OP_PRINT,
+        [OP_LOOP]          = &&vm_target_OP_LOOP,
+        [OP_JUMP]          = &&vm_target_OP_JUMP,
+        [OP_JUMP_IF_FALSE] = &&vm_target_OP_JUMP_IF_FALSE,
+        [OP_INHERIT]       = &&vm_target_OP_INHERIT,
+        [OP_CLASS]         = &&vm_target_OP_CLASS,
+        [OP_METHOD]        = &&vm_target_OP_METHOD,
+        [OP_CLOSURE]       = &&vm_target_OP_CLOSURE,
+        [OP_CONSTANT]      = &&vm_target_OP_CONSTANT,
+        [OP_SET_LOCAL]     = &&vm_target_OP_SET_LOCAL,
+        [OP_SET_GLOBAL]    = &&vm_target_OP_SET_GLOBAL,
+        [OP_SET_UPVALUE]   = &&vm_target_OP_SET_UPVALUE,
+        [OP_SET_PROPERTY]  = &&vm_target_OP_SET_PROPERTY,
+        [OP_GET_LOCAL]     = &&vm_target_OP_GET_LOCAL,
+        [OP_GET_GLOBAL]    = &&vm_target_OP_GET_GLOBAL,
+        [OP_GET_UPVALUE]   = &&vm_target_OP_GET_UPVALUE,
+        [OP_GET_UPVALUE_FLAT] = &&vm_target_OP_GET_UPVALUE_FLAT,
+        [OP_GET_PROPERTY]  = &&vm_target_OP_GET_PROPERTY,
+        [OP_GET_SUPER]     = &&vm_target_OP_GET_SUPER,
+        [OP_CLOSE_UPVALUE] = &&vm_target_OP_CLOSE_UPVALUE,
+        [OP_DEFINE_GLOBAL] = &&vm_target_OP_DEFINE_GLOBAL,
+        [OP_NIL]           = &&vm_target_OP_NIL,
+        [OP_TRUE]          = &&vm_target_OP_TRUE,
+        [OP_FALSE]         = &&vm_target_OP_FALSE,
+        [OP_NOT]           = &&vm_target_OP_NOT,
+        [OP_ADD]           = &&vm_target_OP_ADD,
+        [OP_NEGATE]        = &&vm_target_OP_NEGATE,
+        [OP_SUBTRACT]      = &&vm_target_OP_SUBTRACT,
+        [OP_MULTIPLY]      = &&vm_target_OP_MULTIPLY,
+        [OP_MODULO]        = &&vm_target_OP_MODULO,
+        [OP_DIVIDE]        = &&vm_target_OP_DIVIDE,
+        [OP_EQUAL]         = &&vm_target_OP_EQUAL,
+        [OP_LESS]          = &&vm_target_OP_LESS,
+        [OP_GREATER]       = &&vm_target_OP_GREATER,
+        [OP_GET_LOCAL_GET_LOCAL] = &&vm_target_OP_GET_LOCAL_GET_LOCAL,
+        [OP_ADD_CONSTANT]        = &&vm_target_OP_ADD_CONSTANT,
+        [OP_SET_LOCAL_POP]       = &&vm_target_OP_SET_LOCAL_POP,
+        [OP_CONSTANT_CALL]       = &&vm_target_OP_CONSTANT_CALL,
+        [OP_LESS_JUMP]           = &&vm_target_OP_LESS_JUMP,
+        [OP_GREATER_JUMP]        = &&vm_target_OP_GREATER_JUMP,
+        [OP_EQUAL_JUMP]          = &&vm_target_OP_EQUAL_JUMP,
+        [OP_ADD_NUMBER]          = &&vm_target_OP_ADD_NUMBER,
+        [OP_ADD_CONSTANT_NUMBER] = &&vm_target_OP_ADD_CONSTANT_NUMBER,
+        [OP_BUILD_LIST]    = &&vm_target_OP_BUILD_LIST,
+        [OP_INDEX_GET]     = &&vm_target_OP_INDEX_GET,
+        [OP_INDEX_SET]     = &&vm_target_OP_INDEX_SET,
+        [OP_LIST_APPEND]   = &&vm_target_OP_LIST_APPEND,
+    };
+
+#   define VM_LOOP      VM_NEXT();
+#   define VM_CASE(op)  vm_target_##op
+#   define VM_NEXT()    do { VM_TRACE(); instr = READ_BYTE(); VM_PROFILE_OP(instr); goto *dispatch_table[instr]; } while (false)
+#   else
+#   define VM_LOOP      vm_loop: VM_TRACE(); instr = READ_BYTE(); VM_PROFILE_OP(instr); switch (instr)
+#   define VM_CASE(op)  case op
+#   define VM_NEXT()    goto vm_loop
+#   endif
+
+    uint8_t instr;
+    VM_LOOP
+    {
+        // Quickened OP_ADD: checks numbers first and skips the string
+        // paths. On non-numeric operands the site deoptimizes itself back
+        // to the generic form and re-dispatches the same instruction.
+        VM_CASE(OP_ADD_NUMBER): {
+            if (!IS_NUMBER(peek(0)) || !IS_NUMBER(peek(1))) {
+                frame->ip[-1] = OP_ADD;
+                frame->ip--;
+                VM_NEXT();
+            }
+            double b = AS_NUMBER(stack_pop());
+            double a = AS_NUMBER(stack_pop());
+            stack_push(NUMBER_VALUE(a + b));
+            VM_NEXT();
+        }
 
-        case OP_ADD: {
-            if (IS_STRING(peek(0)) && IS_STRING(peek(1))) {
+        VM_CASE(OP_ADD): {
+            if (is_string_like(peek(0)) && is_string_like(peek(1))) {
                 concatenate();
             } else if (IS_NUMBER(peek(0)) && IS_NUMBER(peek(1))) {
                 double b = AS_NUMBER(stack_pop());
@@ -289,12 +863,12 @@ static InterpretResult run()
                 runtime_error("Operands must be either 2 numbers or 2 strings.");
                 return INTERPRET_RUNTIME_ERROR;
             }
-            break; 
+            VM_NEXT();
         }
-        case OP_SUBTRACT: { BINARY_OP(NUMBER_VALUE, -); break; }
-        case OP_MULTIPLY: { BINARY_OP(NUMBER_VALUE, *); break; }
-        case OP_DIVIDE:   { BINARY_OP(NUMBER_VALUE, /); break; }
-        case OP_MODULO: {
+        VM_CASE(OP_SUBTRACT): { BINARY_OP(NUMBER_VALUE, -); VM_NEXT(); }
+        VM_CASE(OP_MULTIPLY): { BINARY_OP(NUMBER_VALUE, *); VM_NEXT(); }
+        VM_CASE(OP_DIVIDE):   { BINARY_OP(NUMBER_VALUE, /); VM_NEXT(); }
+        VM_CASE(OP_MODULO): {
             if (!IS_NUMBER(peek(0)) || !IS_NUMBER(peek(1))) {
                     runtime_error("Operands must be numbers.");
                     return INTERPRET_RUNTIME_ERROR;
@@ -302,175 +876,398 @@ static InterpretResult run()
             int b = (int)AS_NUMBER(stack_pop());
             int a = (int)AS_NUMBER(stack_pop());
             stack_push(NUMBER_VALUE(a % b));
-            break;
+            VM_NEXT();
         }
-        case OP_NEGATE:   { 
+        VM_CASE(OP_NEGATE):   { 
             if (!IS_NUMBER(peek(0))) {
                 runtime_error("Operand must be a number.");
                 return INTERPRET_RUNTIME_ERROR;
             }
 
             stack_push(NUMBER_VALUE(-AS_NUMBER(stack_pop()))); 
-            break;
+            VM_NEXT();
         }
-        case OP_CONSTANT: { stack_push(READ_CONSTANT()); break; }
-        case OP_NIL:   { stack_push(NIL_VALUE); break; }
-        case OP_TRUE:  { stack_push(BOOL_VALUE(true)); break; }
-        case OP_FALSE: { stack_push(BOOL_VALUE(false)); break; }
-        case OP_NOT: {
+        VM_CASE(OP_CONSTANT): { stack_push(READ_CONSTANT()); VM_NEXT(); }
+        VM_CASE(OP_NIL):   { stack_push(NIL_VALUE); VM_NEXT(); }
+        VM_CASE(OP_TRUE):  { stack_push(BOOL_VALUE(true)); VM_NEXT(); }
+        VM_CASE(OP_FALSE): { stack_push(BOOL_VALUE(false)); VM_NEXT(); }
+        VM_CASE(OP_NOT): {
             stack_push(BOOL_VALUE(is_falsey(stack_pop())));
-            break;
+            VM_NEXT();
         }
 
-        case OP_POP: { stack_pop(); break; }
-        case OP_EQUAL: {
-            Value b = stack_pop();
-            Value a = stack_pop();
-            stack_push(BOOL_VALUE(values_equal(a, b)));
-            break;
+        VM_CASE(OP_POP): { stack_pop(); VM_NEXT(); }
+        VM_CASE(OP_EQUAL): {
+            // Compare before popping: equality may flatten ropes, and the
+            // allocation that entails must see both operands as roots.
+            bool equal = values_equal(peek(1), peek(0));
+            stack_pop();
+            stack_pop();
+            stack_push(BOOL_VALUE(equal));
+            VM_NEXT();
         }
 
-        case OP_GREATER: { BINARY_OP(BOOL_VALUE, >); break; }
-        case OP_LESS:    { BINARY_OP(BOOL_VALUE, <); break; }
+        VM_CASE(OP_GREATER): { BINARY_OP(BOOL_VALUE, >); VM_NEXT(); }
+        VM_CASE(OP_LESS):    { BINARY_OP(BOOL_VALUE, <); VM_NEXT(); }
 
-        case OP_LOOP: {
+        VM_CASE(OP_LOOP): {
             uint16_t offset = READ_SHORT();
             frame->ip -= offset;
-            break;
+
+            // Back edges heat a function up just like invocations do, so a
+            // hot loop tiers up without waiting to be called again. The
+            // rewrite is in place, so the resumed ip stays valid.
+            ObjectFunction* function = frame->function;
+            if (!function->tiered && ++function->heat >= TIER_UP_HEAT) {
+                function->tiered = true;
+                quicken_chunk(&function->chunk);
+            }
+            VM_NEXT();
         }
 
-        case OP_RETURN: {
+        VM_CASE(OP_RETURN): {
             Value result = stack_pop();
-            
+
+#ifdef VM_PROFILE
+            frame->function->inclusive_time +=
+                (double)(clock() - frame->profile_start) / CLOCKS_PER_SEC;
+#endif
+
             close_upvalues(frame->slots);
 
-            vm.frame_count--;
-            if (vm.frame_count == 0) {
-                stack_pop();
-                return INTERPRET_OK;
+            vm->fiber->frame_count--;
+            if (vm->fiber->frame_count == 0) {
+                ObjectFiber* finished = vm->fiber;
+                if (finished->caller == NULL) {
+                    stack_pop();
+                    return INTERPRET_OK;
+                }
+
+                // The fiber is done: hand the result to its resumer.
+                ObjectFiber* target = finished->caller;
+                release_fiber(finished);
+                vm->fiber = unwind_to_live_fiber(target);
+
+                stack_push(result);
+                frame = &vm->fiber->frames[vm->fiber->frame_count - 1];
+                VM_NEXT();
             }
 
-            vm.stack_top = frame->slots;
+            vm->fiber->stack_top = frame->slots;
             stack_push(result);
 
-            frame = &vm.frames[vm.frame_count - 1];
-            break;
+            frame = &vm->fiber->frames[vm->fiber->frame_count - 1];
+            VM_NEXT();
+        }
+
+        VM_CASE(OP_YIELD): {
+            ObjectFiber* current = vm->fiber;
+            if (current->caller == NULL) {
+                runtime_error("Can't yield from the main fiber.");
+                return INTERPRET_RUNTIME_ERROR;
+            }
+
+            Value value = stack_pop();
+            current->state  = FIBER_SUSPENDED;
+            vm->fiber       = unwind_to_live_fiber(current->caller);
+            current->caller = NULL;
+            // A parked old fiber can hold young values the minor
+            // collector would otherwise never visit.
+            gc_remember((Object*)current);
+
+            stack_push(value);
+            frame = &vm->fiber->frames[vm->fiber->frame_count - 1];
+            VM_NEXT();
         }
-        case OP_CALL: {
+        VM_CASE(OP_CALL): {
             int arg_count = READ_BYTE();
             if (!call_value(peek(arg_count), arg_count)) {
                 return INTERPRET_RUNTIME_ERROR;
             }
-            frame = &vm.frames[vm.frame_count - 1];
-            break;
+            frame = &vm->fiber->frames[vm->fiber->frame_count - 1];
+            VM_NEXT();
+        }
+
+        VM_CASE(OP_TAIL_CALL): {
+            int arg_count = READ_BYTE();
+
+#ifdef VM_PROFILE
+            frame->function->inclusive_time +=
+                (double)(clock() - frame->profile_start) / CLOCKS_PER_SEC;
+#endif
+
+            // The current frame is finished: close over its locals, slide
+            // the callee and arguments down over its window and pop it, so
+            // the call below lands in the reclaimed slot.
+            close_upvalues(frame->slots);
+
+            Value* base = frame->slots;
+            Value* callee = vm->fiber->stack_top - arg_count - 1;
+            for (int i = 0; i <= arg_count; i++) {
+                base[i] = callee[i];
+            }
+            vm->fiber->stack_top = base + arg_count + 1;
+            vm->fiber->frame_count--;
+
+            if (!call_value(peek(arg_count), arg_count)) {
+                return INTERPRET_RUNTIME_ERROR;
+            }
+            if (vm->fiber->frame_count == 0) {
+                // The callee pushed no frame (a native, or a class with
+                // no init), so the tail call finished the fiber; deliver
+                // its result to the resumer exactly like OP_RETURN.
+                Value result = stack_pop();
+                ObjectFiber* finished = vm->fiber;
+                if (finished->caller == NULL) {
+                    return INTERPRET_OK;
+                }
+
+                ObjectFiber* target = finished->caller;
+                release_fiber(finished);
+                vm->fiber = unwind_to_live_fiber(target);
+                stack_push(result);
+            }
+            frame = &vm->fiber->frames[vm->fiber->frame_count - 1];
+            VM_NEXT();
+        }
+
+        VM_CASE(OP_TAIL_INVOKE): {
+            ObjectString* method = READ_STRING();
+            int arg_count        = READ_BYTE();
+            Chunk* chunk = &frame->function->chunk;
+            InvokeCache* cache = invoke_cache(chunk, (int)(frame->ip - chunk->code) - 3);
+            // A cache miss below stores bare pointers into the chunk.
+            gc_remember((Object*)frame->function);
+
+#ifdef VM_PROFILE
+            frame->function->inclusive_time +=
+                (double)(clock() - frame->profile_start) / CLOCKS_PER_SEC;
+#endif
+
+            // Same frame reuse as OP_TAIL_CALL, with the receiver in the
+            // callee slot.
+            close_upvalues(frame->slots);
+
+            Value* base = frame->slots;
+            Value* receiver = vm->fiber->stack_top - arg_count - 1;
+            for (int i = 0; i <= arg_count; i++) {
+                base[i] = receiver[i];
+            }
+            vm->fiber->stack_top = base + arg_count + 1;
+            vm->fiber->frame_count--;
+
+            if (!invoke(method, arg_count, cache)) {
+                return INTERPRET_RUNTIME_ERROR;
+            }
+            if (vm->fiber->frame_count == 0) {
+                // Same frameless-callee completion as OP_TAIL_CALL.
+                Value result = stack_pop();
+                ObjectFiber* finished = vm->fiber;
+                if (finished->caller == NULL) {
+                    return INTERPRET_OK;
+                }
+
+                ObjectFiber* target = finished->caller;
+                release_fiber(finished);
+                vm->fiber = unwind_to_live_fiber(target);
+                stack_push(result);
+            }
+            frame = &vm->fiber->frames[vm->fiber->frame_count - 1];
+            VM_NEXT();
         }
-        case OP_JUMP: {
+        VM_CASE(OP_JUMP): {
             uint16_t offset = READ_SHORT();
             frame->ip += offset;
-            break;
+            VM_NEXT();
+        }
+
+        VM_CASE(OP_JUMP_IF_FALSE): {
+            uint16_t offset = READ_SHORT();
+            if (is_falsey(peek(0)))
+                frame->ip += offset;
+            VM_NEXT();
+        }
+
+        VM_CASE(OP_LESS_JUMP): {
+            uint16_t offset = READ_SHORT();
+            if (!IS_NUMBER(peek(0)) || !IS_NUMBER(peek(1))) {
+                runtime_error("Operands must be numbers.");
+                return INTERPRET_RUNTIME_ERROR;
+            }
+            double b = AS_NUMBER(stack_pop());
+            double a = AS_NUMBER(stack_pop());
+            if (!(a < b))
+                frame->ip += offset;
+            VM_NEXT();
+        }
+
+        VM_CASE(OP_GREATER_JUMP): {
+            uint16_t offset = READ_SHORT();
+            if (!IS_NUMBER(peek(0)) || !IS_NUMBER(peek(1))) {
+                runtime_error("Operands must be numbers.");
+                return INTERPRET_RUNTIME_ERROR;
+            }
+            double b = AS_NUMBER(stack_pop());
+            double a = AS_NUMBER(stack_pop());
+            if (!(a > b))
+                frame->ip += offset;
+            VM_NEXT();
         }
 
-        case OP_JUMP_IF_FALSE: {
+        VM_CASE(OP_EQUAL_JUMP): {
             uint16_t offset = READ_SHORT();
-            if (is_falsey(peek(0))) 
+            // Compare before popping, as in OP_EQUAL.
+            bool equal = values_equal(peek(1), peek(0));
+            stack_pop();
+            stack_pop();
+            if (!equal)
                 frame->ip += offset;
-            break;
+            VM_NEXT();
         }
 
-        case OP_PRINT: {
+        VM_CASE(OP_PRINT): {
             print_value(stack_pop());
             printf("\n");
-            break;
+            VM_NEXT();
         }
         
-        case OP_DEFINE_GLOBAL: {
-            ObjectString* name = READ_STRING();
-            table_set(&vm.globals, name, peek(0));
-            break;
+        VM_CASE(OP_DEFINE_GLOBAL): {
+            uint8_t slot = READ_BYTE();
+            vm->global_slots.values[slot] = stack_pop();
+            VM_NEXT();
         }
         
-        case OP_GET_LOCAL: {
+        VM_CASE(OP_GET_LOCAL): {
             uint8_t slot = READ_BYTE();
             stack_push(frame->slots[slot]);
-            break;
+            VM_NEXT();
         }
 
-        case OP_SET_LOCAL: {
+        VM_CASE(OP_SET_LOCAL): {
             uint8_t slot = READ_BYTE();
             frame->slots[slot] = peek(0);
-            break;
+            VM_NEXT();
         }
 
-        case OP_SET_GLOBAL: {
-            ObjectString* name = READ_STRING();
-            if (table_set(&vm.globals, name, peek(0))) {
-                table_del(&vm.globals, name);
-                runtime_error("Undefined variable '%s'.\n", name->chars);
+        VM_CASE(OP_SET_GLOBAL): {
+            uint8_t slot = READ_BYTE();
+            if (IS_EMPTY(vm->global_slots.values[slot])) {
+                runtime_error("Undefined variable '%s'.", global_name(slot)->chars);
                 return INTERPRET_RUNTIME_ERROR;
             }
-            break;
+            vm->global_slots.values[slot] = peek(0);
+            VM_NEXT();
         }
-        case OP_GET_GLOBAL: {
-            ObjectString* name = READ_STRING();
-            Value value;
-            if (!table_get(&vm.globals, name, &value)) {
-                runtime_error("Undefined variable '%s'.\n", name->chars);
+        VM_CASE(OP_GET_GLOBAL): {
+            uint8_t slot = READ_BYTE();
+            Value value = vm->global_slots.values[slot];
+            if (IS_EMPTY(value)) {
+                runtime_error("Undefined variable '%s'.", global_name(slot)->chars);
                 return INTERPRET_RUNTIME_ERROR;
             }
             stack_push(value);
-            break;
+            VM_NEXT();
         }
 
-        case OP_GET_UPVALUE: {
+        VM_CASE(OP_GET_UPVALUE): {
             uint8_t slot = READ_BYTE();
             stack_push(*frame->closure->upvalues[slot]->location);
-            break;
+            VM_NEXT();
         }
 
-        case OP_SET_UPVALUE: {
+        VM_CASE(OP_GET_UPVALUE_FLAT): {
+            uint8_t slot = READ_BYTE();
+            stack_push(frame->closure->flat[slot]);
+            VM_NEXT();
+        }
+
+        VM_CASE(OP_SET_UPVALUE): {
             uint8_t slot = READ_BYTE();
             *frame->closure->upvalues[slot]->location = peek(0);
-            break;
+            gc_write_barrier((Object*)frame->closure->upvalues[slot], peek(0));
+            VM_NEXT();
         }
 
-        case OP_CLOSE_UPVALUE: {
-            close_upvalues(vm.stack_top - 1);
+        VM_CASE(OP_CLOSE_UPVALUE): {
+            close_upvalues(vm->fiber->stack_top - 1);
             stack_pop();
-            break;
+            VM_NEXT();
         }
 
-        case OP_CLOSURE: {
+        VM_CASE(OP_CLOSURE): {
             ObjectFunction* function = AS_FUNCTION(READ_CONSTANT());
             ObjectClosure* closure = new_closure(function);
             stack_push(OBJECT_VALUE(closure));
             for (int i = 0; i < closure->upvalue_count; i++) {
-                uint8_t is_local = READ_BYTE();
-                uint8_t index    = READ_BYTE();
-                if (is_local) {
+                uint8_t kind  = READ_BYTE();
+                uint8_t index = READ_BYTE();
+                if (kind == 2) {
+                    // Immutable capture: copy the value, no box.
+                    closure->flat[i] = frame->slots[index];
+                    gc_write_barrier((Object*)closure, closure->flat[i]);
+                    continue;
+                }
+
+                if (kind == 1) {
                     closure->upvalues[i] = capture_upvalue(frame->slots + index);
                 } else {
                     closure->upvalues[i] = frame->closure->upvalues[index];
                 }
+                // capture_upvalue can allocate, and an allocation can
+                // promote the closure out from under us mid-loop.
+                gc_write_barrier((Object*)closure, OBJECT_VALUE(closure->upvalues[i]));
             }
-            break;
+            VM_NEXT();
         }
 
-        case OP_SET_PROPERTY: {
+        VM_CASE(OP_SET_PROPERTY): {
             if (!IS_INSTANCE(peek(1))) {
                 runtime_error("Only instances have fields.");
                 return INTERPRET_RUNTIME_ERROR;
             }
 
             ObjectInstance* instance = AS_INSTANCE(peek(1));
-            table_set(&instance->fields, READ_STRING(), peek(0));
+            ObjectString* name       = READ_STRING();
+
+            Chunk* chunk = &frame->function->chunk;
+            PropertyCache* cache = property_cache(chunk, (int)(frame->ip - chunk->code) - 2);
+
+            if (cache->shape == instance->shape && cache->shape != NULL) {
+                if (cache->next_shape != NULL) {
+                    ensure_field_capacity(instance, cache->slot);
+                    instance->fields[cache->slot] = peek(0);
+                    instance->shape = cache->next_shape;
+                    gc_write_barrier((Object*)instance, OBJECT_VALUE(cache->next_shape));
+                } else {
+                    instance->fields[cache->slot] = peek(0);
+                }
+            } else {
+                int slot = shape_slot(instance->shape, name);
+                if (slot != -1) {
+                    cache->shape      = instance->shape;
+                    cache->next_shape = NULL;
+                    cache->slot       = slot;
+                    instance->fields[slot] = peek(0);
+                } else {
+                    ObjectShape* next = shape_add(instance->shape, name);
+                    cache->shape      = instance->shape;
+                    cache->next_shape = next;
+                    cache->slot       = next->slot;
+                    ensure_field_capacity(instance, next->slot);
+                    instance->fields[next->slot] = peek(0);
+                    instance->shape = next;
+                    gc_write_barrier((Object*)instance, OBJECT_VALUE(next));
+                }
+            }
+            gc_write_barrier((Object*)instance, peek(0));
 
             Value value = stack_pop();
             stack_pop();
             stack_push(value);
-            break;
+            VM_NEXT();
         }
 
-        case OP_GET_PROPERTY: {
+        VM_CASE(OP_GET_PROPERTY): {
             if (!IS_INSTANCE(peek(0))) {
                 runtime_error("Only instances have properties.");
                 return INTERPRET_RUNTIME_ERROR;
@@ -479,49 +1276,66 @@ static InterpretResult run()
             ObjectInstance* instance = AS_INSTANCE(peek(0));
             ObjectString* name       = READ_STRING();
 
-            Value value;
-            if (table_get(&instance->fields, name, &value)) {
+            Chunk* chunk = &frame->function->chunk;
+            PropertyCache* cache = property_cache(chunk, (int)(frame->ip - chunk->code) - 2);
+
+            if (cache->shape == instance->shape && cache->shape != NULL &&
+                cache->next_shape == NULL) {
                 stack_pop();
-                stack_push(value);
-                break;
+                stack_push(instance->fields[cache->slot]);
+                VM_NEXT();
+            }
+
+            int slot = shape_slot(instance->shape, name);
+            if (slot != -1) {
+                cache->shape      = instance->shape;
+                cache->next_shape = NULL;
+                cache->slot       = slot;
+                stack_pop();
+                stack_push(instance->fields[slot]);
+                VM_NEXT();
             }
 
             if (!bind_method(instance->klass, name)) {
                 return INTERPRET_RUNTIME_ERROR;
             }
-            break;
+            VM_NEXT();
         }
 
-        case OP_GET_SUPER: {
+        VM_CASE(OP_GET_SUPER): {
             ObjectString* name = READ_STRING();
             ObjectClass*  super_class = AS_CLASS(stack_pop());
             if (!bind_method(super_class, name)) {
                 return INTERPRET_RUNTIME_ERROR;
             }
-            break;
+            VM_NEXT();
         }
 
-        case OP_CLASS: {
+        VM_CASE(OP_CLASS): {
             stack_push(OBJECT_VALUE(new_class(READ_STRING())));
-            break;
+            VM_NEXT();
         }
 
-        case OP_METHOD: {
+        VM_CASE(OP_METHOD): {
             define_method(READ_STRING());
-            break;
+            VM_NEXT();
         }
 
-        case OP_INVOKE: {
+        VM_CASE(OP_INVOKE): {
             ObjectString* method = READ_STRING();
             int arg_count        = READ_BYTE();
-            if (!invoke(method, arg_count)) {
+            Chunk* chunk = &frame->function->chunk;
+            InvokeCache* cache = invoke_cache(chunk, (int)(frame->ip - chunk->code) - 3);
+            // A cache miss below stores bare pointers into the chunk.
+            gc_remember((Object*)frame->function);
+            if (!invoke(method, arg_count, cache)) {
                 return INTERPRET_RUNTIME_ERROR;
             }
-            frame = &vm.frames[vm.frame_count - 1];
-            break;
+            frame = &vm->fiber->frames[vm->fiber->frame_count - 1];
+            VM_NEXT();
         }
 
-        case OP_INHERIT: {
+        VM_CASE(OP_INHERIT): {
             Value superclass = peek(1);
             if (!IS_CLASS(superclass)) {
                 runtime_error("Superclass must be a class.");
@@ -530,23 +1344,158 @@ static InterpretResult run()
 
             ObjectClass* subclass = AS_CLASS(peek(0));
             table_add_all(&AS_CLASS(superclass)->methods, &subclass->methods);
+            // table_add_all can allocate mid-copy; remember the subclass
+            // wholesale rather than tracking every copied entry.
+            gc_remember((Object*)subclass);
             stack_pop(); // subclass
-            break;
+            VM_NEXT();
         }
 
-        case OP_SUPER_INVOKE: {
+        VM_CASE(OP_SUPER_INVOKE): {
             ObjectString* method = READ_STRING();
             int arg_count        = READ_BYTE();
             ObjectClass* super_class = AS_CLASS(stack_pop());
-            if (!invoke_from_class(super_class, method, arg_count)) {
+            Chunk* chunk = &frame->function->chunk;
+            InvokeCache* cache = invoke_cache(chunk, (int)(frame->ip - chunk->code) - 3);
+            gc_remember((Object*)frame->function);
+            if (!invoke_from_class(super_class, method, arg_count, cache)) {
+                return INTERPRET_RUNTIME_ERROR;
+            }
+            frame = &vm->fiber->frames[vm->fiber->frame_count - 1];
+            VM_NEXT();
+        }
+
+        VM_CASE(OP_GET_LOCAL_GET_LOCAL): {
+            uint8_t slot_a = READ_BYTE();
+            uint8_t slot_b = READ_BYTE();
+            stack_push(frame->slots[slot_a]);
+            stack_push(frame->slots[slot_b]);
+            VM_NEXT();
+        }
+
+        VM_CASE(OP_ADD_CONSTANT): {
+            Value b = READ_CONSTANT();
+            if (IS_NUMBER(peek(0)) && IS_NUMBER(b)) {
+                stack_push(NUMBER_VALUE(AS_NUMBER(stack_pop()) + AS_NUMBER(b)));
+            } else if (is_string_like(peek(0)) && IS_STRING(b)) {
+                stack_push(b);
+                concatenate();
+            } else {
+                runtime_error("Operands must be either 2 numbers or 2 strings.");
+                return INTERPRET_RUNTIME_ERROR;
+            }
+            VM_NEXT();
+        }
+
+        // Quickened OP_ADD_CONSTANT; deoptimizes like OP_ADD_NUMBER.
+        VM_CASE(OP_ADD_CONSTANT_NUMBER): {
+            Value b = READ_CONSTANT();
+            if (!IS_NUMBER(peek(0)) || !IS_NUMBER(b)) {
+                frame->ip -= 2;
+                frame->ip[0] = OP_ADD_CONSTANT;
+                VM_NEXT();
+            }
+            stack_push(NUMBER_VALUE(AS_NUMBER(stack_pop()) + AS_NUMBER(b)));
+            VM_NEXT();
+        }
+
+        VM_CASE(OP_SET_LOCAL_POP): {
+            uint8_t slot = READ_BYTE();
+            frame->slots[slot] = stack_pop();
+            VM_NEXT();
+        }
+
+        VM_CASE(OP_BUILD_LIST): {
+            uint8_t count = READ_BYTE();
+            ObjectList* list = new_list();
+            stack_push(OBJECT_VALUE(list));
+            for (int i = count; i > 0; i--) {
+                write_value_array(&list->items, peek(i));
+                gc_write_barrier((Object*)list, peek(i));
+            }
+            vm->fiber->stack_top -= count + 1;
+            stack_push(OBJECT_VALUE(list));
+            VM_NEXT();
+        }
+
+        VM_CASE(OP_LIST_APPEND): {
+            ObjectList* list = AS_LIST(peek(1));
+            write_value_array(&list->items, peek(0));
+            gc_write_barrier((Object*)list, peek(0));
+            stack_pop();
+            VM_NEXT();
+        }
+
+        VM_CASE(OP_INDEX_GET): {
+            if (!IS_LIST(peek(1))) {
+                runtime_error("Only lists can be indexed.");
+                return INTERPRET_RUNTIME_ERROR;
+            }
+            if (!IS_NUMBER(peek(0))) {
+                runtime_error("List index must be a number.");
+                return INTERPRET_RUNTIME_ERROR;
+            }
+
+            ObjectList* list = AS_LIST(peek(1));
+            double number = AS_NUMBER(peek(0));
+            int index = (int)number;
+            if (index != number || index < 0 || index >= list->items.count) {
+                runtime_error("List index out of range.");
+                return INTERPRET_RUNTIME_ERROR;
+            }
+
+            stack_pop();
+            stack_pop();
+            stack_push(list->items.values[index]);
+            VM_NEXT();
+        }
+
+        VM_CASE(OP_INDEX_SET): {
+            if (!IS_LIST(peek(2))) {
+                runtime_error("Only lists can be indexed.");
+                return INTERPRET_RUNTIME_ERROR;
+            }
+            if (!IS_NUMBER(peek(1))) {
+                runtime_error("List index must be a number.");
+                return INTERPRET_RUNTIME_ERROR;
+            }
+
+            ObjectList* list = AS_LIST(peek(2));
+            double number = AS_NUMBER(peek(1));
+            int index = (int)number;
+            if (index != number || index < 0 || index >= list->items.count) {
+                runtime_error("List index out of range.");
                 return INTERPRET_RUNTIME_ERROR;
             }
-            frame = &vm.frames[vm.frame_count - 1];
-            break;
+
+            list->items.values[index] = peek(0);
+            gc_write_barrier((Object*)list, peek(0));
+
+            Value value = stack_pop();
+            stack_pop();
+            stack_pop();
+            stack_push(value);
+            VM_NEXT();
         }
+
+        VM_CASE(OP_CONSTANT_CALL): {
+            stack_push(READ_CONSTANT());
+            int arg_count = READ_BYTE();
+            if (!call_value(peek(arg_count), arg_count)) {
+                return INTERPRET_RUNTIME_ERROR;
+            }
+            frame = &vm->fiber->frames[vm->fiber->frame_count - 1];
+            VM_NEXT();
         }
     }
 
+    return INTERPRET_RUNTIME_ERROR; // Unreachable.
+
+#   undef VM_LOOP
+#   undef VM_CASE
+#   undef VM_NEXT
+#   undef VM_TRACE
+#   undef VM_PROFILE_OP
 #   undef BINARY_OP
 #   undef READ_BYTE
 #   undef READ_SHORT
@@ -556,32 +1505,91 @@ static InterpretResult run()
 
 void init_vm()
 {
-    reset_stack();
-    vm.bytes_allocated = 0;
-    vm.gray_capacity   = 0;
-    vm.gray_count      = 0;
-    vm.gray_stack      = NULL;
-    vm.objects         = NULL;
-    vm.next_gc         = 1024 * 1024;
-    init_table(&vm.strings);
-    init_table(&vm.globals);
-
-    vm.init_string = NULL;
-    vm.init_string = copy_string("init", 4);
-
-    define_native("clock", clock_native);
+    pool_retain();
+
+    vm->fiber           = NULL;
+    vm->push_guard      = NIL_VALUE;
+    vm->bytes_allocated = 0;
+    vm->gray_capacity   = 0;
+    vm->gray_count      = 0;
+    vm->gray_stack      = NULL;
+    vm->objects         = NULL;
+    vm->old_objects     = NULL;
+    vm->remembered      = NULL;
+    vm->remembered_count    = 0;
+    vm->remembered_capacity = 0;
+    vm->next_gc         = 1024 * 1024;
+    vm->next_minor_gc   = 256 * 1024;
+    vm->gc_paused       = 0;
+    vm->gc_grow_factor  = 2;
+    vm->gc_minor_cycles = 0;
+    vm->gc_major_cycles = 0;
+    vm->gc_total_pause  = 0;
+    vm->gc_max_pause    = 0;
+    vm->gc_cycle_hook   = NULL;
+
+#ifdef VM_PROFILE
+    memset(vm->opcode_counts, 0, sizeof(vm->opcode_counts));
+#endif
+    init_table(&vm->strings);
+    init_table(&vm->global_names);
+    init_value_array(&vm->global_slots);
+
+    // Allocations below can collect, so the roots they feed must already
+    // be in a defined state.
+    vm->init_string   = NULL;
+    vm->root_shape    = NULL;
+    vm->repl_function = NULL;
+
+    // The main fiber everything runs on; scripts never see it as a value.
+    vm->fiber = new_fiber(NULL);
+    vm->fiber->state = FIBER_RUNNING;
+
+    vm->init_string = copy_string("init", 4);
+    vm->root_shape  = new_shape(NULL, NULL);
+
+    define_native("clock", clock_native, 0, "");
+    define_native("append", append_native, 2, "l.");
+    define_native("len", len_native, 1, ".");
+    define_native("floor", floor_native, 1, "n");
+    define_native("sqrt", sqrt_native, 1, "n");
+    define_native("abs", abs_native, 1, "n");
+    define_native("substr", substr_native, 3, "snn");
+    define_native("find", find_native, 2, "ss");
+    define_native("pop", pop_native, 1, "l");
+    define_native("indexOf", index_of_native, 2, "l.");
+    define_native("slice", slice_native, 3, "lnn");
+    define_native("reverse", reverse_native, 1, "l");
+    define_native("gcCollect", gc_collect_native, 0, "");
+    define_native("gcStats", gc_stats_native, 0, "");
+    define_native("gcObjects", gc_objects_native, 0, "");
+    define_native("gcTune", gc_tune_native, 2, "nn");
+    define_native("profileReport", profile_report_native, 0, "");
+    define_native("fiber", fiber_native, 1, "c");
+    define_native("fiberDone", fiber_done_native, 1, "f");
 }
 
 void free_vm()
 {   
-    free_table(&vm.globals);
-    free_table(&vm.strings);
+    free_table(&vm->global_names);
+    free_value_array(&vm->global_slots);
+    free_table(&vm->strings);
 
-    vm.init_string = NULL;
+    vm->init_string = NULL;
 
     free_objects();
 }
 
+InterpretResult interpret_function(ObjectFunction* function)
+{
+    // The top-level script captures nothing, so it runs as a bare function
+    // and never pays for a closure allocation.
+    stack_push(OBJECT_VALUE(function));
+    call_value(OBJECT_VALUE(function), 0);
+
+    return run();
+}
+
 InterpretResult interpret(const char* source)
 {
     ObjectFunction* function = compile(source);
@@ -589,13 +1597,51 @@ InterpretResult interpret(const char* source)
         return INTERPRET_COMPILE_ERROR;
     }
 
-    //stack_push(OBJECT_VALUE(function));
-    //call_value(OBJECT_VALUE(function), 0);
+    return interpret_function(function);
+}
 
-    ObjectClosure* closure = new_closure(function);
-    stack_pop();
-    stack_push(OBJECT_VALUE(closure));
-    call_value(OBJECT_VALUE(closure), 0);
+InterpretResult interpret_repl(const char* source)
+{
+    ObjectFunction* function = compile_repl(source);
+    if (function == NULL) {
+        return INTERPRET_COMPILE_ERROR;
+    }
 
-    return run();
+    return interpret_function(function);
+}
+
+VM* vm_create()
+{
+    VM* isolate = (VM*)malloc(sizeof(VM));
+    if (isolate == NULL)
+        return NULL;
+
+    // init_vm() (and the allocations it performs) run against the
+    // thread-local VM, so bind the new isolate for the call.
+    VM* previous = vm;
+    vm = isolate;
+    init_vm();
+    vm = previous;
+
+    return isolate;
+}
+
+InterpretResult vm_interpret(VM* isolate, const char* source)
+{
+    VM* previous = vm;
+    vm = isolate;
+    InterpretResult result = interpret(source);
+    vm = previous;
+
+    return result;
+}
+
+void vm_destroy(VM* isolate)
+{
+    VM* previous = vm;
+    vm = isolate;
+    free_vm();
+    vm = previous == isolate ? NULL : previous;
+
+    free(isolate);
 }